@@ -0,0 +1,115 @@
+#ifndef __BACKPROJ_LUT_HPP__
+#define __BACKPROJ_LUT_HPP__
+
+#include "opencv2/core/core.hpp"
+
+#include <vector>
+
+#include "Backproject.hpp"
+#include "HueMask.hpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Backprojection of a hue histogram straight from BGR.
+ *
+ * With the histogram and the S/V thresholds fixed, the masked backprojection
+ * of a pixel only depends on its BGR value. build() tabulates it on a
+ * 2^Bits x 2^Bits x 2^Bits grid (sampled at the cell centres), apply() then
+ * costs one table lookup per pixel instead of hue conversion, masking,
+ * calcBackProject and the mask AND. With Bits = 8 the table is exact.
+ */
+class BackprojLUT
+{
+public:
+
+    BackprojLUT(int Bits = 5)
+    :   bits(Bits)
+    {
+        CV_Assert(Bits >= 1 && Bits <= 8);
+    }
+
+    int cell_bits() const
+    {
+        return bits;
+    }
+
+    bool empty() const
+    {
+        return table.empty();
+    }
+
+    void clear()
+    {
+        table.clear();
+    }
+
+    /**
+     * Tabulates the backprojection of the 1D hue histogram Hist over
+     * Range[0]..Range[1] for pixels passing the S/V thresholds, see HueMask.
+     */
+    void build(const Mat &Hist, const float *Range, int SMin, int VMin, int VMax)
+    {
+        const int           n = 1 << bits;
+        const int           shift = 8 - bits;
+        const int           half = (1 << shift) >> 1;
+        HueMask::Limits     lim(SMin, VMin, VMax);
+        HueMask::RowKernel  kernel = HueMask::row_kernel();
+        uchar               weight[256];
+        vector<uchar>       bgr(3 * n * n);
+        vector<uchar>       hue(n * n);
+        vector<uchar>       mask(n * n);
+
+        hue_weights(Hist, Range, weight);
+
+        table.resize((size_t)n * n * n);
+
+        // one plane of constant blue per kernel call
+        for (int g = 0; g < n; ++g)
+            for (int r = 0; r < n; ++r)
+            {
+                bgr[3*(g*n + r) + 1] = (uchar)((g << shift) + half);
+                bgr[3*(g*n + r) + 2] = (uchar)((r << shift) + half);
+            }
+
+        for (int b = 0; b < n; ++b)
+        {
+            for (int i = 0; i < n * n; ++i)
+                bgr[3*i] = (uchar)((b << shift) + half);
+
+            kernel(&bgr[0], &hue[0], &mask[0], n * n, lim);
+
+            uchar *plane = &table[(size_t)b * n * n];
+            for (int i = 0; i < n * n; ++i)
+                plane[i] = mask[i] ? weight[hue[i]] : 0;
+        }
+    }
+
+    // Masked backprojection of an 8 bit BGR image.
+    void apply(const Mat &Image, Mat &Backproj) const
+    {
+        CV_Assert(Image.type() == CV_8UC3 && !empty());
+
+        const int       shift = 8 - bits;
+        const uchar     *lut = &table[0];
+
+        Backproj.create(Image.size(), CV_8UC1);
+
+        for (int y = 0; y < Image.rows; ++y)
+        {
+            const uchar *src = Image.ptr<uchar>(y);
+            uchar       *dst = Backproj.ptr<uchar>(y);
+
+            for (int x = 0; x < Image.cols; ++x, src += 3)
+                dst[x] = lut[(((src[0] >> shift) << bits | (src[1] >> shift)) << bits) | (src[2] >> shift)];
+        }
+    }
+
+private:
+
+    int             bits;
+    vector<uchar>   table;      // [b][g][r] cell -> backprojection
+};
+
+#endif
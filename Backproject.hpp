@@ -0,0 +1,108 @@
+#ifndef __BACKPROJECT_HPP__
+#define __BACKPROJECT_HPP__
+
+#include "opencv2/core/core.hpp"
+
+#include <algorithm> // std::max, std::min
+
+#ifdef __unix__
+#include <unistd.h>
+#endif
+
+using namespace cv;
+
+/**
+ * Hue -> backprojection weight of the 1D histogram Hist over
+ * Range[0]..Range[1], the lookup table calcBackProject builds for 8 bit
+ * input with a uniform histogram and scale 1.
+ */
+inline void hue_weights(const Mat &Hist, const float *Range, uchar Weights[256])
+{
+    int     size = (int)Hist.total();
+    double  a = size / (double)(Range[1] - Range[0]);
+    double  b = -a * Range[0];
+
+    for (int h = 0; h < 256; ++h)
+    {
+        int idx = cvFloor(h * a + b);
+        Weights[h] = (unsigned)idx < (unsigned)size ? saturate_cast<uchar>(Hist.at<float>(idx)) : 0;
+    }
+}
+
+// Bytes of L2 cache per core, 256 KB when the system does not say.
+inline size_t l2_cache_size()
+{
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (size > 0)
+        return (size_t)size;
+#endif
+    return 256 * 1024;
+}
+
+// Bands of rows of the masked backprojection.
+class MaskedBackprojectBody : public ParallelLoopBody
+{
+public:
+
+    MaskedBackprojectBody(const Mat &Hue, const Mat &Mask, const uchar *Weights, Mat &Backproj, int BandRows)
+    :   hue(Hue),
+        mask(Mask),
+        weights(Weights),
+        backproj(Backproj),
+        band_rows(BandRows)
+    {
+    }
+
+    virtual void operator()(const Range &Bands) const
+    {
+        int first = Bands.start * band_rows;
+        int last = std::min(Bands.end * band_rows, hue.rows);
+
+        for (int y = first; y < last; ++y)
+        {
+            const uchar *h = hue.ptr<uchar>(y);
+            const uchar *m = mask.ptr<uchar>(y);
+            uchar       *dst = backproj.ptr<uchar>(y);
+
+            for (int x = 0; x < hue.cols; ++x)
+                dst[x] = weights[h[x]] & m[x];
+        }
+    }
+
+private:
+
+    const Mat   &hue;
+    const Mat   &mask;
+    const uchar *weights;
+    Mat         &backproj;
+    int         band_rows;
+};
+
+/**
+ * Backproj = calcBackProject of Hue through Weights (see hue_weights),
+ * ANDed with Mask, in one pass. Rows are split into bands whose hue, mask
+ * and output fit in half the L2 cache and processed in parallel, or all
+ * on the calling thread when Parallel is false.
+ */
+inline void masked_backproject(const Mat &Hue, const Mat &Mask, const uchar *Weights, Mat &Backproj,
+                               bool Parallel = true)
+{
+    CV_Assert(Hue.type() == CV_8UC1 && Mask.type() == CV_8UC1 && Hue.size() == Mask.size());
+
+    Backproj.create(Hue.size(), CV_8UC1);
+    if (Hue.empty())
+        return;
+
+    int band_rows = std::max(1, (int)(l2_cache_size() / 2 / (3 * Hue.cols)));
+    int bands = (Hue.rows + band_rows - 1) / band_rows;
+
+    MaskedBackprojectBody body(Hue, Mask, Weights, Backproj, band_rows);
+
+    if (Parallel)
+        parallel_for_(Range(0, bands), body);
+    else
+        body(Range(0, bands));
+}
+
+#endif
@@ -1,52 +1,134 @@
 #ifndef __CAM_SHIFT_PROCESSOR_HPP__
 #define __CAM_SHIFT_PROCESSOR_HPP__
 
-#include "VideoProcessor.hpp"
+#include <fstream>
 
-class CamShiftProcessor : public VideoProcessor
+#include "Backproject.hpp"
+#include "BackprojLUT.hpp"
+#include "GlobalSearch.hpp"
+#include "HueMask.hpp"
+#include "HueProcessor.hpp"
+#include "MomentShift.hpp"
+#include "Trajectory.hpp"
+
+class CamShiftProcessor : public HueProcessor
 {
 
 public:
 
     CamShiftProcessor(VideoCapture &Frames, string WindowName)
-    :   VideoProcessor(Frames, WindowName),
-        smin(30),
-        vmin(10),
-        vmax(256),
-        hsize(16),
+    :   HueProcessor(Frames, WindowName),
         histimg( Mat::zeros(200, 320, CV_8UC3) ),
         tracking(false),
-        phranges(hranges)
+        use_lut(false),
+        use_roi(false),
+        use_tiled(false),
+        lost(true),
+        hue_partial(false),
+        record(NULL),
+        frame_offset(0),
+        iterations(0),
+        held_weight(0)
+    {
+    }
+
+    // Backprojects through a BGR lookup table with 2^Bits cells per channel
+    // while tracking, see BackprojLUT.hpp. 0 turns it off.
+    void SetLookup(int Bits)
+    {
+        use_lut = Bits > 0;
+        if (use_lut)
+        {
+            lut = BackprojLUT(Bits);
+            if (!hist.empty())
+                lut.build(hist, phranges, smin, vmin, vmax);
+        }
+    }
+
+    // Converts and backprojects only around the search window while the
+    // target is held, see search_margin().
+    void SetRegionOfInterest(bool Enable)
+    {
+        use_roi = Enable;
+    }
+
+    // Backprojects and masks in one pass over row bands on all cores, see
+    // masked_backproject(). Same result as calcBackProject and the mask AND.
+    void SetTiledBackprojection(bool Enable)
+    {
+        use_tiled = Enable;
+    }
+
+    // Writes the tracked box of every frame to File as CSV.
+    void SetTrajectoryOutput(const string &File)
+    {
+        trajectory.open(File.c_str());
+        if (!trajectory)
+            cout << "Could not open trajectory file " << File << endl;
+        else
+            write_trajectory_header(trajectory);
+    }
+
+    // Appends the tracked box of every frame to Record.
+    void SetTrajectoryRecord(vector<TrackRecord> *Record)
+    {
+        record = Record;
+    }
+
+    // Number of the frame before the first one read, for trajectories of
+    // streams that do not start at the beginning.
+    void SetFrameOffset(int Offset)
+    {
+        frame_offset = Offset;
+    }
+
+    /**
+     * Tracks a target with histogram Hist, as built by region_selected,
+     * instead of a selection. The first frame is searched for the Window
+     * sized region that matches best, see acquire_target().
+     */
+    void SetHistogram(const Mat &Hist, const Size &Window)
     {
-        hranges[0] = 0;
-        hranges[1] = 180;
+        Hist.copyTo(hist);
+        acquire_size = Window;
+        histogram_changed();
     }
 
-    void SetThresholds(int VMin, int VMax, int SMin)
+    const Mat &Histogram() const
     {
-        vmin = VMin;
-        vmax = VMax;
-        smin = SMin;
+        return hist;
+    }
+
+    // Mean shift steps CamShift took on the last tracked frame.
+    int Iterations() const
+    {
+        return iterations;
     }
 
   
 protected:
 
-    int         smin;
-    int         vmin;
-    int         vmax;
-    int         hsize;
-    Mat         hsv;
-    Mat         hue;
-    Mat         mask;
     Mat         hist;
     Mat         histimg;
     Mat         backproj;
     bool        tracking;
+    bool        use_lut;
+    BackprojLUT lut;
+    bool        use_roi;
+    bool        use_tiled;
+    uchar       weights[256];   // hue -> backprojection for use_tiled
+    bool        lost;           // no target in the last frame
+    bool        hue_partial;    // hue and mask do not cover the frame
+    Mat         shown;          // last processed frame without overlays
+    ofstream    trajectory;
+    vector<TrackRecord> *record;
+    int         frame_offset;
+    Size        acquire_size;   // window searched for by acquire_target()
+    int         iterations;     // mean shift steps of the last frame
+    float       held_weight;    // decaying mean weight in the window while held
+    Size        held_size;      // window size while held
     Rect        trackWindow;
     RotatedRect trackBox;
-    float       hranges[2];
-    const float *phranges;
 
 
     virtual Rect search_window(Mat Image, const RotatedRect &TrackBox, const Rect &TrackWindow)
@@ -56,62 +138,265 @@ protected:
 
     virtual void track_results(Mat Image, const RotatedRect &TrackBox)
     {
-        ellipse(Image, TrackBox, Scalar(0,0,255), 3, CV_AA);                              
+        if (overlay_mode())
+            ellipse(Image, TrackBox, Scalar(0,0,255), 3, CV_AA);                              
     }
 
-    virtual void process_frame(Mat image)
+    // Margin around the search window processed in region of interest mode.
+    // Half the window allows meanShift a few steps in any direction.
+    virtual Size search_margin(const Rect &Window)
+    {
+        return MomentShift::search_margin(Window);
+    }
+
+    // Region worth searching first for a target lost with a window of size
+    // Window, an empty Rect for the whole frame.
+    virtual Rect reacquire_area(const Size &Window)
+    {
+        return Rect();
+    }
+
+    /**
+     * Searches for a lost target in Image, first in reacquire_area() and
+     * then in the whole frame. The densest window of the held size in the
+     * backprojection of the area seeds CamShift; a result weighing more
+     * than Weight replaces trackBox and trackWindow. Region receives the
+     * area backproj then covers. Returns whether the target was found.
+     */
+    bool reacquire(Mat Image, bool Prepared, float Weight, Rect &Region)
     {
-        int ch[] = {0, 0};
+        Rect    frame(0, 0, Image.cols, Image.rows);
+        Rect    area = reacquire_area(held_size) & frame;
+        bool    found = false;
+
+        if (area.area() == 0)
+            area = frame;
 
+        while (!found)
+        {
+            if (Prepared)
+            {
+                backproject(Mat(hue, area), Mat(mask, area));
+            }
+            else if (use_lut)
+            {
+                lut.apply(Mat(Image, area), backproj);
+            }
+            else
+            {
+                HueMask::hue_mask(Mat(Image, area), hue, mask, smin, vmin, vmax);
+                hue_partial = area != frame;
+                backproject(hue, mask);
+            }
+            Region = area;
 
-        cvtColor(image, hsv, CV_BGR2HSV);
-        inRange( hsv, 
-                 Scalar(0, smin, min(vmin,vmax)), 
-                 Scalar(180, 256, max(vmin, vmax)), 
-                 mask );
+            Rect window;
+            if (densest_window(backproj, held_size, window))
+            {
+                RotatedRect box = cam_shift(backproj, window, &iterations);
+                float       w = MomentShift::window_weight(backproj, window);
+
+                if (w > Weight)
+                {
+                    trackBox = box;
+                    trackBox.center.x += area.x;
+                    trackBox.center.y += area.y;
+                    trackWindow = window + area.tl();
+                    found = !MomentShift::lost_weight(w, held_weight);
+                    Weight = w;
+                }
+            }
 
-        hue.create(hsv.size(), hsv.depth());
+            if (area == frame)
+                break;
+            area = frame;
+        }
 
-        mixChannels(&hsv, 1, &hue, 1, ch, 1);
+        return found;
+    }
 
-        if (tracking)
+    // Keeps the frame about to be processed for selections on it while it
+    // is shown, hue and mask may not cover it. Only the GUI selects.
+    void keep_frame(const Mat &Image)
+    {
+        if (!headless_mode())
+            Image.copyTo(shown);
+    }
+
+    // Writes trackBox of the current frame to the trajectory and record.
+    void record_box(bool Lost)
+    {
+        if (trajectory.is_open() || record)
+        {
+            TrackRecord r(frame_offset + frameCount, to_view(trackBox), Lost);
+            if (trajectory.is_open())
+                write_trajectory(trajectory, r);
+            if (record)
+                record->push_back(r);
+        }
+    }
+
+    virtual void thresholds_changed()
+    {
+        if (use_lut && !hist.empty())
+            lut.build(hist, phranges, smin, vmin, vmax);
+    }
+
+    // Rebuilds the tables derived from hist.
+    void histogram_changed()
+    {
+        hue_weights(hist, phranges, weights);
+        if (use_lut)
+            lut.build(hist, phranges, smin, vmin, vmax);
+    }
+
+    // Masked backprojection of hist into backproj.
+    void backproject(const Mat &Hue, const Mat &Mask)
+    {
+        if (use_tiled)
+        {
+            masked_backproject(Hue, Mask, weights, backproj);
+        }
+        else
         {
-            calcBackProject(&hue, 1, 0, hist, backproj, &phranges);
-            backproj &= mask;
+            calcBackProject(&Hue, 1, 0, hist, backproj, &phranges);
+            backproj &= Mask;
+        }
+    }
 
+    virtual void process_frame(Mat image)
+    {
+        bool    prepared = take_prepared();
+        bool    lookup = use_lut && tracking && !prepared;
+        Rect    frame(0, 0, image.cols, image.rows);
+        Rect    roi = frame;
+
+        keep_frame(image);
+
+        if (tracking)
+        {
             trackWindow = search_window(image, trackBox, trackWindow);
-            rectangle(image, trackWindow, Scalar(0,0,0));
 
-            trackBox = CamShift(backproj, trackWindow,
-                                 TermCriteria(CV_TERMCRIT_EPS | CV_TERMCRIT_ITER, 10, 1));
+            // the full frame is searched again once the target is lost
+            if (use_roi && !lost)
+                roi = MomentShift::search_area(trackWindow, search_margin(trackWindow), frame);
+        }
+
+        Mat     view(image, roi);
+        Mat     hue_view, mask_view;
+
+        if (prepared)
+        {
+            hue_view = Mat(hue, roi);
+            mask_view = Mat(mask, roi);
+            hue_partial = false;
+        }
+        else
+        {
+            // hue plane and S/V mask in one pass, same as cvtColor + inRange + mixChannels
+            if (!lookup)
+                HueMask::hue_mask(view, hue, mask, smin, vmin, vmax);
+            hue_view = hue;
+            mask_view = mask;
+            hue_partial = lookup || roi != frame;
+        }
 
+        if (tracking)
+        {
+            if (lookup)
+                lut.apply(view, backproj);
+            else
+                backproject(hue_view, mask_view);
+
+            // backproj covers roi only
+            Rect searched = trackWindow;
+            Rect window = trackWindow - roi.tl();
+            trackBox = cam_shift(backproj, window, &iterations);
+            trackBox.center.x += roi.x;
+            trackBox.center.y += roi.y;
+            trackWindow = window + roi.tl();
+
+            // lost when CamShift collapsed or the window holds too little of
+            // the colour, then search again within this frame
+            float weight = MomentShift::window_weight(backproj, window);
+            lost = MomentShift::lost_weight(weight, held_weight);
+
+            if (lost && held_size.area() > 0)
+            {
+                lost = !reacquire(image, prepared, weight, roi);
+                searched = roi;
+            }
 
-            if (trackWindow.area() <= 1) 
+            if (!lost)
             {
-                int cols = backproj.cols, rows = backproj.rows, r = (MIN(cols, rows) + 5)/6;
-                trackWindow = Rect(trackWindow.x - r, trackWindow.y - r,
-                                   trackWindow.x + r, trackWindow.y + r) &
-                              Rect(0, 0, cols, rows);
+                weight = MomentShift::window_weight(backproj, trackWindow - roi.tl());
+                held_weight = MomentShift::hold_weight(held_weight, weight);
+                held_size = trackWindow.size();
             }
 
+            record_box(lost);
+            // nothing found anywhere, widen the window for the next frame
+            if (lost && trackWindow.area() <= 1)
+                trackWindow = MomentShift::lost_window(trackWindow, frame);
+
             if (backproj_mode())
-                cvtColor(backproj, image, CV_GRAY2BGR);
+            {
+                Mat view(image, roi);
+
+                if (roi != frame)
+                    image = Scalar::all(0);
+                cvtColor(backproj, view, CV_GRAY2BGR);
+            }
 
+            // overlays last, reacquire() may convert the image again
+            if (overlay_mode())
+                rectangle(image, searched, Scalar(0,0,0));
             track_results(image, trackBox);
         }
     }
 
 
+    // Finds the target of the histogram given to SetHistogram in the whole
+    // frame and starts tracking it.
+    virtual bool acquire_target()
+    {
+        Rect found;
+
+        if (hist.empty() || hue_partial)
+            return false;
+
+        backproject(hue, mask);
+        if (!densest_window(backproj, acquire_size, found))
+            return false;
+
+        trackWindow = found;
+        tracking = true;
+        lost = false;
+        held_weight = 0;
+        held_size = found.size();
+        return true;
+    }
+
     virtual void region_selected(const Rect &Region)
     {
+        // hue and mask may be missing or cover a region of interest only,
+        // take them from the frame as displayed, frame_image() already
+        // holds the next one during playback
+        if (hue_partial)
+            HueMask::hue_mask(shown.empty() ? frame_image() : shown, hue, mask, smin, vmin, vmax);
+
         Mat     roi(hue, Region), 
                 maskroi(mask, Region);
         int     binW;
 
         calcHist(&roi, 1, 0, maskroi, hist, 1, &hsize, &phranges);
         normalize(hist, hist, 0, 255, CV_MINMAX);
+        histogram_changed();
 
         trackWindow = Region;
+        lost = false;
+        held_weight = 0;
+        held_size = Region.size();
 
         histimg = Scalar::all(0);
         binW = histimg.cols / hsize;
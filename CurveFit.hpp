@@ -1,5 +1,101 @@
-struct CurveFit
+#ifndef __CURVE_FIT_HPP__
+#define __CURVE_FIT_HPP__
+
+#include "opencv2/core/core.hpp"
+
+#include <cmath>
+
+using namespace cv;
+
+/**
+ * Static interface of the motion predictors plugged into CurveFitProcessor.
+ *
+ * Impl derives from CurveFit<Impl> and provides
+ *
+ *   void    update(int frame, const Point2f &pos)      add a tracked position
+ *   Point2f predict(int frame) const                   predicted position
+ *   void    reset()                                    forget all positions
+ *   void    interpolate(int frame, int count, float *xs, float *ys) const
+ *                                                      positions for count
+ *                                                      consecutive frames
+ *   Size2f  spread(int frame) const                    1-sigma uncertainty of
+ *                                                      the predicted position
+ *   size_t  size() const                               positions seen
+ *
+ * Calls are resolved at compile time. CurveFit adds the running error of
+ * the predictions, measured on every position before it is added.
+ */
+template<class Impl>
+class CurveFit
 {
-    virtual float error() = 0;
-    
-}
\ No newline at end of file
+public:
+
+    CurveFit()
+        :   err(0),
+            measured(0)
+    {
+    }
+
+    void push_back(int frame, const Point2f &pos) {
+        if (impl().size() > 0) {
+            Point2f d = impl().predict(frame) - pos;
+            float e = std::sqrt(d.x * d.x + d.y * d.y);
+            err = measured ? err + ERROR_DECAY * (e - err) : e;
+            ++measured;
+        }
+        impl().update(frame, pos);
+    }
+
+    Point2f operator[](int frame) const {
+        return impl().predict(frame);
+    }
+
+    // Window of size window around the position predicted for frame, grown
+    // on every side by sigmas times spread() and by margin pixels.
+    Rect predicted_window(int frame, const Size &window, float sigmas = 2, float margin = 0) const {
+        Size2f s = impl().spread(frame);
+        float w = window.width + 2 * (sigmas * s.width + margin);
+        float h = window.height + 2 * (sigmas * s.height + margin);
+        Point2f p = impl().predict(frame);
+        return Rect(p.x - w/2, p.y - h/2, w, h);
+    }
+
+    void clear() {
+        err = 0;
+        measured = 0;
+        impl().reset();
+    }
+
+    // Exponentially decaying mean distance between the position predicted
+    // for a frame and the one tracked, in pixels.
+    float error() const {
+        return err;
+    }
+
+    // Number of predictions error() is based on.
+    int error_samples() const {
+        return measured;
+    }
+
+protected:
+
+    static const float ERROR_DECAY;
+
+private:
+
+    float err;
+    int measured;
+
+    Impl &impl() {
+        return static_cast<Impl &>(*this);
+    }
+
+    const Impl &impl() const {
+        return static_cast<const Impl &>(*this);
+    }
+};
+
+template<class Impl>
+const float CurveFit<Impl>::ERROR_DECAY = 0.1f;
+
+#endif
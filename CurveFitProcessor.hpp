@@ -4,85 +4,193 @@
 #include <vector>
 
 #include "CamShiftProcessor.hpp"
-#include "LSFit.hpp"
+#include "Predictor.hpp"
 #include "Stats.hpp"
 
-using LS::LSFit;
-
+/**
+ * Tracks with CamShift and seeds each search window with the position the
+ * Predictor expects for the frame, see CurveFit.hpp.
+ */
+template<class Predictor = CurvePredictor<> >
 class CurveFitProcessor : public CamShiftProcessor
 {
 public:
 
-    CurveFitProcessor(VideoCapture &Frames, string WindowName)
+    CurveFitProcessor(VideoCapture &Frames, string WindowName,
+                      const Predictor &Pred = Predictor())
         :   CamShiftProcessor(Frames, WindowName),
             HISTORY_LEN(50),
-            lsf_x(true),
-            lsf_y(true)
+            predictor(Pred),
+            update_ticks(0),
+            updates(0),
+            max_skip(0),
+            skip_error(2),
+            skip_left(0),
+            skipped(0)
+    {
+    }
+
+    virtual ~CurveFitProcessor()
+    {
+        if (updates > 0)
+            cout << "Predictor update: " << update_ticks * 1e6 / getTickFrequency() / updates
+                 << " us/frame over " << updates << " frames" << endl;
+        if (skipped > 0)
+            cout << "Predicted " << skipped << " of " << frameCount << " frames without tracking" << endl;
+    }
+
+    /**
+     * Tracks only every k-th frame, 1 <= k <= MaxSkip, and takes the frames
+     * in between from the predictor. k is the furthest horizon whose recent
+     * prediction error (see Stats::recent_error) is at most MaxError
+     * pixels, so it shrinks back to 1 when the motion turns erratic.
+     * MaxSkip <= 1 tracks every frame.
+     */
+    void SetFrameSkipping(int MaxSkip, float MaxError)
     {
+        max_skip = std::min(MaxSkip, (int)Stats::PREDCOUNT);
+        skip_error = MaxError;
     }
 
 protected:
 
     const int       HISTORY_LEN;
     deque<pair<int, Point2f> >  point_history;
-    LSFit<LS::CURVE_DEG_CUBIC, int, float> lsf_x;
-    LSFit<LS::CURVE_DEG_CUBIC, int, float> lsf_y;
+    Predictor       predictor;
     Stats           stats;
+    int64           update_ticks;   // time spent updating and evaluating the predictor
+    int             updates;
+    int             max_skip;
+    float           skip_error;
+    int             skip_left;      // frames to predict before tracking again
+    int             skipped;
+
+    // Predictions this many frames ahead must have been scored before they
+    // are trusted for skipping.
+    static const int SKIP_SAMPLES = 5;
+
+    virtual void process_frame(Mat image)
+    {
+        if (skip_left > 0 && tracking && !lost && predictor.size() > 0)
+        {
+            --skip_left;
+            ++skipped;
+            hue_partial = true;     // hue and mask are from a tracked frame
+            keep_frame(image);
+            predict_frame(image);
+            return;
+        }
+
+        CamShiftProcessor::process_frame(image);
+        skip_left = tracking && !lost ? frames_to_skip() : 0;
+    }
+
+    // Frames the predictor may fill in after a tracked one.
+    int frames_to_skip() const
+    {
+        int k = 1;
+
+        while (k < max_skip && stats.recent_samples(k + 1) >= SKIP_SAMPLES &&
+               stats.recent_error(k + 1) <= skip_error)
+            ++k;
+        return k - 1;
+    }
+
+    // Moves the box to the predicted position instead of tracking.
+    void predict_frame(Mat Image)
+    {
+        Point2f p = predictor[frame_time()];
+
+        trackBox.center = p;
+        trackWindow.x = cvRound(p.x - trackWindow.width * 0.5f);
+        trackWindow.y = cvRound(p.y - trackWindow.height * 0.5f);
+        record_box(false);
+
+        if (overlay_mode())
+            ellipse(Image, trackBox, Scalar(0,255,255), 2, CV_AA);
+    }
 
     virtual Rect search_window(Mat Image, const RotatedRect &TrackBox, const Rect &TrackWindow) {
-        if (frameCount <= 1)
+        if (frameCount <= 1 || predictor.size() == 0)
             return TrackWindow;
-        float w = TrackWindow.width;
-        float h = TrackWindow.height;
-        return Rect (lsf_x[frameCount] - (w/2), lsf_y[frameCount] - (h/2), w, h);
+        // grow the window by two standard deviations of the prediction
+        return predictor.predicted_window(frame_time(), TrackWindow.size());
+    }
+
+    // Widens the margin by the error the predictor has been making, so the
+    // region of interest shrinks while predictions are good.
+    virtual Size search_margin(const Rect &Window)
+    {
+        Size m = CamShiftProcessor::search_margin(Window);
+        int e = cvCeil(2 * predictor.error());
+        return Size(m.width + e, m.height + e);
+    }
+
+    // Around the predicted position, as far as the prediction may be off.
+    virtual Rect reacquire_area(const Size &Window)
+    {
+        if (predictor.size() == 0)
+            return Rect();
+
+        return predictor.predicted_window(frame_time(), Window, 3,
+                                          2 * predictor.error() + MomentShift::TOLERANCE);
     }
 
     virtual void track_results(Mat Image, const RotatedRect &TrackBox)
     {
+        // a lost box says nothing about the motion
+        if (lost)
+            return;
+
         Point2f     pts[4];
         TrackBox.points(pts);
         Point2f center = (pts[0] + pts[2]) * 0.5;
-        point_history.push_back(make_pair(frameCount, center));
+        point_history.push_back(make_pair(frame_time(), center));
         if (point_history.size() > HISTORY_LEN)
             point_history.pop_front();
 
-        // clear history when radical direction changes happen
-        size_t sx = lsf_x.size();
-        size_t sy = lsf_y.size();
-        if (sx >= 2 && (lsf_x.at(sx-1) - lsf_x.at(sx-2)) * (center.x - lsf_x.at(sx-1)) < -2) {
-            cout << "cleared x: " << lsf_x.at(sx-2) << ", " << lsf_x.at(sx-1) << ", " << center.x << endl;
-            lsf_x.clear();
-        }
-        if (sy >= 2 && (lsf_y.at(sy-1) - lsf_y.at(sy-2)) * (center.y - lsf_y.at(sy-1)) < -2) {
-            cout << "cleared y: " << lsf_y.at(sy-2) << ", " << lsf_y.at(sy-1) << ", " << center.y << endl;
-            lsf_y.clear();
-        }
+        // add new points to the motion predictor
+        int64 start = getTickCount();
+        predictor.push_back(frame_time(), center);
 
-        // add new points to curve fitting algorithm (LSFit)
-        lsf_x.push_back(frameCount, center.x);
-        lsf_y.push_back(frameCount, center.y);
+        // predict next occurance
+        const int first = -20;
+        float px[Stats::PREDCOUNT - first + 1];
+        float py[Stats::PREDCOUNT - first + 1];
+        predictor.interpolate(frame_time() + first, Stats::PREDCOUNT - first + 1, px, py);
+        update_ticks += getTickCount() - start;
+        ++updates;
+
+        // score earlier forecasts and keep this one, for frame skipping
+        vector<Point2f> ahead;
+        for (int i = 1; i <= Stats::PREDCOUNT; ++i)
+            ahead.push_back(Point2f(px[i - first], py[i - first]));
+        stats.add_position(frame_time(), center);
+        stats.add_forecast(frame_time(), ahead);
 
         // draw object location history
         typedef deque<pair<int,Point2f> >::const_reverse_iterator rev_point_it;
-        for (rev_point_it it = point_history.rbegin(); it != point_history.rend(); ++it) {
-            circle(Image, it->second, 4, Scalar(255,0,0), 2);
+        if (overlay_mode()) {
+            for (rev_point_it it = point_history.rbegin(); it != point_history.rend(); ++it) {
+                circle(Image, it->second, 4, Scalar(255,0,0), 2);
+            }
         }
 
-        stats.print_stats(point_history);
+        // the console table is for watching, not for batch runs
+        if (!headless_mode())
+            stats.print_stats(point_history);
 
-        // predict next occurance
         vector<float> curpred; // stats
         // draw next predicted points
-        for (int i = -20; i <= Stats::PREDCOUNT; ++i) {
-            float x = lsf_x[frameCount + i];
-            float y = lsf_y[frameCount + i];
+        for (int i = first; i <= Stats::PREDCOUNT; ++i) {
+            float x = px[i - first];
+            float y = py[i - first];
             if (i > 0)
                 curpred.push_back(sqrt(x*x+y*y)); // stats
-            Point2f p(x, y);
-            circle(Image, p, 4, Scalar(i < 0 ? 255 : 0,255,0), 2);
+            if (overlay_mode())
+                circle(Image, Point2f(x, y), 4, Scalar(i < 0 ? 255 : 0,255,0), 2);
         }
         stats.add_pred(curpred); // stats
     }
-    
-};
 
+};
@@ -0,0 +1,184 @@
+#ifndef __ENSEMBLE_HPP__
+#define __ENSEMBLE_HPP__
+
+#include "opencv2/core/core.hpp"
+
+#include <iostream>
+
+#include "CurveFit.hpp"
+#include "Predictor.hpp"
+
+using namespace cv;
+using namespace std;
+
+
+/**
+ * Compile-time list of the predictors of an Ensemble, e.g.
+ * Members<CurvePredictor<>, Members<KalmanPredictor> >. Member i is reached
+ * by recursion over the list, so each call resolves statically.
+ */
+struct MembersEnd
+{
+    enum { count = 0 };
+};
+
+template<class Head, class Tail = MembersEnd>
+struct Members
+{
+    enum { count = 1 + Tail::count };
+
+    Head head;
+    Tail tail;
+
+    void push_back(int i, int frame, const Point2f &pos) {
+        if (i == 0)
+            head.push_back(frame, pos);
+        else
+            tail.push_back(i - 1, frame, pos);
+    }
+
+    Point2f predict(int i, int frame) const {
+        return i == 0 ? head[frame] : tail.predict(i - 1, frame);
+    }
+
+    void interpolate(int i, int frame, int count, float *xs, float *ys) const {
+        if (i == 0)
+            head.interpolate(frame, count, xs, ys);
+        else
+            tail.interpolate(i - 1, frame, count, xs, ys);
+    }
+
+    Size2f spread(int i, int frame) const {
+        return i == 0 ? head.spread(frame) : tail.spread(i - 1, frame);
+    }
+
+    float error(int i) const {
+        return i == 0 ? head.error() : tail.error(i - 1);
+    }
+
+    int error_samples(int i) const {
+        return i == 0 ? head.error_samples() : tail.error_samples(i - 1);
+    }
+
+    void clear() {
+        head.clear();
+        tail.clear();
+    }
+};
+
+template<class Head>
+struct Members<Head, MembersEnd>
+{
+    enum { count = 1 };
+
+    Head head;
+
+    void push_back(int, int frame, const Point2f &pos) {
+        head.push_back(frame, pos);
+    }
+
+    Point2f predict(int, int frame) const {
+        return head[frame];
+    }
+
+    void interpolate(int, int frame, int count, float *xs, float *ys) const {
+        head.interpolate(frame, count, xs, ys);
+    }
+
+    Size2f spread(int, int frame) const {
+        return head.spread(frame);
+    }
+
+    float error(int) const {
+        return head.error();
+    }
+
+    int error_samples(int) const {
+        return head.error_samples();
+    }
+
+    void clear() {
+        head.clear();
+    }
+};
+
+
+/**
+ * Runs several predictors side by side and predicts with the one of the
+ * lowest running error. The members are updated one after the other: an
+ * update costs microseconds, less than handing it to a thread pool, and
+ * members may print.
+ */
+template<class List>
+class Ensemble : public CurveFit<Ensemble<List> >
+{
+public:
+
+    // Predictions a member needs before it can be selected.
+    static const int MIN_SAMPLES = 5;
+
+    Ensemble()
+        :   best(0),
+            samples(0)
+    {
+    }
+
+    void update(int frame, const Point2f &pos) {
+        for (int i = 0; i < List::count; ++i)
+            models.push_back(i, frame, pos);
+        ++samples;
+
+        int sel = best;
+        for (int i = 0; i < List::count; ++i) {
+            if (models.error_samples(i) >= MIN_SAMPLES
+                    && (models.error_samples(sel) < MIN_SAMPLES || models.error(i) < models.error(sel)))
+                sel = i;
+        }
+        if (sel != best)
+            cout << "ensemble: switched to model " << sel << " (error " << models.error(sel) << ")" << endl;
+        best = sel;
+    }
+
+    Point2f predict(int frame) const {
+        return models.predict(best, frame);
+    }
+
+    void interpolate(int frame, int count, float *xs, float *ys) const {
+        models.interpolate(best, frame, count, xs, ys);
+    }
+
+    Size2f spread(int frame) const {
+        return models.spread(best, frame);
+    }
+
+    size_t size() const {
+        return samples;
+    }
+
+    void reset() {
+        models.clear();
+        best = 0;
+        samples = 0;
+    }
+
+    // Index of the member currently predicting.
+    int selected() const {
+        return best;
+    }
+
+private:
+
+    List models;
+    int best;
+    size_t samples;
+};
+
+// Weighted cubic, unweighted cubic, weighted quadratic and linear fits and
+// a constant acceleration Kalman filter.
+typedef Ensemble<Members<CurvePredictor<LS::CURVE_DEG_CUBIC, true>,
+                 Members<CurvePredictor<LS::CURVE_DEG_CUBIC, false>,
+                 Members<CurvePredictor<LS::CURVE_DEG_QUAD, true>,
+                 Members<CurvePredictor<LS::CURVE_DEG_LIN, true>,
+                 Members<KalmanPredictor> > > > > > PredictorEnsemble;
+
+#endif
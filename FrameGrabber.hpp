@@ -0,0 +1,168 @@
+#ifndef __FRAME_GRABBER_HPP__
+#define __FRAME_GRABBER_HPP__
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include <algorithm> // std::swap
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Decodes frames of a VideoCapture on its own thread into a bounded ring of
+ * Mat buffers, so decoding overlaps with processing.
+ *
+ * VideoCapture::read may hand back a header over the backend's own buffer,
+ * which the next read overwrites, so each frame is copied once out of it.
+ * From there buffers are swapped, not copied, between the capture thread,
+ * the ring and the reader: once every buffer has been allocated at the
+ * frame size decoding no longer allocates. When the ring is full the
+ * capture thread either waits for the reader (BLOCK, no frame is lost, for
+ * files) or overwrites the oldest frame (DROP_OLDEST, keeps latency bounded
+ * for live cameras).
+ */
+class FrameGrabber
+{
+public:
+
+    enum Policy
+    {
+        BLOCK,
+        DROP_OLDEST
+    };
+
+    FrameGrabber(VideoCapture &Frames, size_t Capacity = 4, Policy FullPolicy = BLOCK)
+    :   frames(Frames),
+        ring(std::max(Capacity, (size_t)1)),
+        stamps(ring.size()),
+        policy(FullPolicy),
+        head(0),
+        count(0),
+        dropped_frames(0),
+        done(false),
+        stopping(false)
+    {
+        worker = thread(&FrameGrabber::run, this);
+    }
+
+    ~FrameGrabber()
+    {
+        {
+            lock_guard<mutex> lock(guard);
+            stopping = true;
+        }
+        not_full.notify_all();
+        worker.join();
+    }
+
+    /**
+     * Waits for the oldest captured frame and swaps it into Frame, whose
+     * previous buffer goes back to the ring. Ticks, if given, receives the
+     * getTickCount() at which it was decoded. Returns false at the end of
+     * the stream.
+     */
+    bool read(Mat &Frame, int64 *Ticks = NULL)
+    {
+        unique_lock<mutex> lock(guard);
+
+        while (count == 0 && !done)
+            not_empty.wait(lock);
+
+        if (count == 0)
+            return false;
+
+        std::swap(Frame, ring[head]);
+        if (Ticks)
+            *Ticks = stamps[head];
+        head = (head + 1) % ring.size();
+        --count;
+
+        lock.unlock();
+        not_full.notify_one();
+        return true;
+    }
+
+    // Frames overwritten before they were read.
+    size_t dropped() const
+    {
+        lock_guard<mutex> lock(guard);
+        return dropped_frames;
+    }
+
+private:
+
+    VideoCapture        &frames;
+    vector<Mat>         ring;
+    vector<int64>       stamps;         // decode time of each ring entry
+    Policy              policy;
+    size_t              head;           // oldest frame
+    size_t              count;          // frames in the ring
+    size_t              dropped_frames;
+    bool                done;           // end of stream reached
+    bool                stopping;       // destructor waiting
+    mutable mutex       guard;
+    condition_variable  not_empty;
+    condition_variable  not_full;
+    thread              worker;
+
+    void run()
+    {
+        Mat     decoded;
+        Mat     spare;
+
+        for (;;)
+        {
+            // decode and copy outside the lock into a buffer nobody else
+            // holds, decoded may be the backend's
+            bool    ok = frames.read(decoded) && !decoded.empty();
+            int64   ticks = getTickCount();
+
+            if (ok)
+                decoded.copyTo(spare);
+
+            unique_lock<mutex> lock(guard);
+
+            if (!ok || stopping)
+            {
+                done = true;
+                break;
+            }
+
+            if (count == ring.size())
+            {
+                if (policy == DROP_OLDEST)
+                {
+                    head = (head + 1) % ring.size();
+                    --count;
+                    ++dropped_frames;
+                }
+                else
+                {
+                    while (count == ring.size() && !stopping)
+                        not_full.wait(lock);
+
+                    if (stopping)
+                    {
+                        done = true;
+                        break;
+                    }
+                }
+            }
+
+            std::swap(spare, ring[(head + count) % ring.size()]);
+            stamps[(head + count) % ring.size()] = ticks;
+            ++count;
+
+            lock.unlock();
+            not_empty.notify_one();
+        }
+
+        not_empty.notify_all();
+    }
+};
+
+#endif
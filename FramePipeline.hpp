@@ -0,0 +1,180 @@
+#ifndef __FRAME_PIPELINE_HPP__
+#define __FRAME_PIPELINE_HPP__
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include <algorithm> // std::swap
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "SPSCQueue.hpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Runs the per-frame work that does not depend on tracking state on three
+ * threads, one per stage:
+ *
+ *   decode -> transform (rotate/scale) -> prepare (e.g. hue and mask)
+ *
+ * so frame N+1 is decoded and converted while frame N is tracked. Stages are
+ * connected by SPSC queues of Depth frames. The frame slots are allocated
+ * once and return to the decoder through a free queue after read(), so
+ * steady state runs without allocation. Decoded frames are copied once
+ * into their slot, VideoCapture::read may return the backend's buffer.
+ */
+class FramePipeline
+{
+public:
+
+    // Work done by the transform and prepare stages.
+    struct Stages
+    {
+        virtual ~Stages()
+        {
+        }
+
+        // may swap buffers with Frame, which is decoded into next
+        virtual void transform_frame(Mat &Frame, Mat &Image) = 0;
+        virtual void prepare_frame(Mat Image, vector<Mat> &Planes) = 0;
+    };
+
+    FramePipeline(VideoCapture &Frames, Stages &Work, size_t Depth = 2)
+    :   frames(Frames),
+        work(Work),
+        slots(3 * Depth + 4),
+        free_slots(slots.size()),
+        decoded(Depth),
+        transformed(Depth),
+        prepared(Depth),
+        stop(false)
+    {
+        for (size_t i = 0; i < slots.size(); ++i)
+            free_slots.try_push(&slots[i]);
+
+        threads.push_back(thread(&FramePipeline::decode, this));
+        threads.push_back(thread(&FramePipeline::transform, this));
+        threads.push_back(thread(&FramePipeline::prepare, this));
+    }
+
+    ~FramePipeline()
+    {
+        stop = true;
+        for (size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+    }
+
+    /**
+     * Swaps the next prepared frame into Image and Planes, whose previous
+     * buffers are recycled. Ticks, if given, receives the getTickCount() at
+     * which it was decoded. Returns false at the end of the stream.
+     */
+    bool read(Mat &Image, vector<Mat> &Planes, int64 *Ticks = NULL)
+    {
+        Frame *f;
+
+        if (!prepared.pop(f, stop) || f->end)
+            return false;
+
+        std::swap(Image, f->image);
+        std::swap(Planes, f->planes);
+        if (Ticks)
+            *Ticks = f->ticks;
+        free_slots.try_push(f);
+        return true;
+    }
+
+    // Queue depths and stalls, a stage with a full queue in front of it and
+    // stalled neighbours is the bottleneck.
+    void report(ostream &Out) const
+    {
+        Out << "Pipeline queue      size  mean  push stalls  pop stalls" << endl;
+        report(Out, "decoded", decoded);
+        report(Out, "transformed", transformed);
+        report(Out, "prepared", prepared);
+    }
+
+private:
+
+    struct Frame
+    {
+        Frame()
+        :   ticks(0),
+            end(false)
+        {
+        }
+
+        Mat             raw;        // as decoded
+        Mat             image;      // transformed
+        vector<Mat>     planes;     // from Stages::prepare_frame
+        int64           ticks;      // getTickCount() when decoded
+        bool            end;        // end of stream marker
+    };
+
+    typedef SPSCQueue<Frame *>  Queue;
+
+    VideoCapture        &frames;
+    Stages              &work;
+    vector<Frame>       slots;
+    Queue               free_slots;
+    Queue               decoded;
+    Queue               transformed;
+    Queue               prepared;
+    atomic<bool>        stop;
+    vector<thread>      threads;
+
+    void decode()
+    {
+        Frame   *f;
+        Mat     scratch;    // may be the backend's buffer, read again next
+
+        while (free_slots.pop(f, stop))
+        {
+            f->end = !frames.read(scratch) || scratch.empty();
+            f->ticks = getTickCount();
+            if (!f->end)
+                scratch.copyTo(f->raw);
+            if (!decoded.push(f, stop) || f->end)
+                break;
+        }
+    }
+
+    void transform()
+    {
+        Frame *f;
+
+        while (decoded.pop(f, stop))
+        {
+            if (!f->end)
+                work.transform_frame(f->raw, f->image);
+            if (!transformed.push(f, stop) || f->end)
+                break;
+        }
+    }
+
+    void prepare()
+    {
+        Frame *f;
+
+        while (transformed.pop(f, stop))
+        {
+            if (!f->end)
+                work.prepare_frame(f->image, f->planes);
+            if (!prepared.push(f, stop) || f->end)
+                break;
+        }
+    }
+
+    static void report(ostream &Out, const char *Name, const Queue &Q)
+    {
+        Out << "  " << left << setw(14) << Name << right
+            << setw(8) << Q.capacity() << setw(6) << fixed << setprecision(2) << Q.mean_depth()
+            << setw(13) << Q.push_stalls() << setw(12) << Q.pop_stalls() << endl;
+    }
+};
+
+#endif
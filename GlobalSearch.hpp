@@ -0,0 +1,52 @@
+#ifndef __GLOBAL_SEARCH_HPP__
+#define __GLOBAL_SEARCH_HPP__
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <algorithm> // std::min, std::max
+
+using namespace cv;
+
+/**
+ * Finds the Window sized rectangle inside Area with the largest sum of the
+ * 8 bit Weights (a backprojection), for (re)acquiring a target without a
+ * usable search window. The sums come from an integral image, so every
+ * position costs four lookups. Returns false when Area has no weight.
+ */
+inline bool densest_window(const Mat &Weights, Size Window, Rect &Found, Rect Area = Rect())
+{
+    if (Area.area() == 0)
+        Area = Rect(0, 0, Weights.cols, Weights.rows);
+    Area &= Rect(0, 0, Weights.cols, Weights.rows);
+
+    Window.width = std::max(1, std::min(Window.width, Area.width));
+    Window.height = std::max(1, std::min(Window.height, Area.height));
+    if (Area.area() == 0)
+        return false;
+
+    Mat     sums;
+    double  best = 0;
+
+    // 64 bit sums, a 4K frame of 255 overflows 32 bits
+    integral(Weights(Area), sums, CV_64F);
+
+    for (int y = 0; y + Window.height <= Area.height; ++y)
+    {
+        const double *top = sums.ptr<double>(y);
+        const double *bottom = sums.ptr<double>(y + Window.height);
+
+        for (int x = 0; x + Window.width <= Area.width; ++x)
+        {
+            double s = bottom[x + Window.width] - bottom[x] - top[x + Window.width] + top[x];
+            if (s > best)
+            {
+                best = s;
+                Found = Rect(Area.x + x, Area.y + y, Window.width, Window.height);
+            }
+        }
+    }
+
+    return best > 0;
+}
+
+#endif
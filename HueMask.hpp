@@ -0,0 +1,259 @@
+#ifndef __HUE_MASK_HPP__
+#define __HUE_MASK_HPP__
+
+#include "opencv2/core/core.hpp"
+
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HUE_MASK_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace cv;
+
+/*
+ * Fused BGR -> hue + saturation/value mask.
+ *
+ * Reads a BGR image once and writes the 8 bit hue plane and the validity
+ * mask, bit-exact with
+ *
+ *   cvtColor(bgr, hsv, CV_BGR2HSV);
+ *   inRange(hsv, Scalar(0, smin, min(vmin, vmax)), Scalar(180, 256, max(vmin, vmax)), mask);
+ *   mixChannels(&hsv, 1, &hue, 1, ch, 1);
+ *
+ * without materializing the 3 channel HSV image. Rows are processed by an
+ * AVX2 or SSE4.1 kernel selected at runtime, with a scalar fallback.
+ */
+namespace HueMask {
+
+// Saturation/value limits of the mask, saturated to 8 bit like inRange.
+struct Limits
+{
+    Limits(int SMin, int VMin, int VMax)
+    :   smin(clamp(SMin)),
+        vlo(clamp(std::min(VMin, VMax))),
+        vhi(clamp(std::max(VMin, VMax)))
+    {
+    }
+
+    int smin;
+    int vlo;
+    int vhi;
+
+    static int clamp(int v)
+    {
+        return std::min(std::max(v, 0), 255);
+    }
+};
+
+// Division tables of OpenCV's 8 bit RGB2HSV with a hue range of 180.
+enum { HSV_SHIFT = 12 };
+
+struct Tables
+{
+    int sdiv[256];
+    int hdiv[256];
+
+    Tables()
+    {
+        sdiv[0] = hdiv[0] = 0;
+        for (int i = 1; i < 256; ++i)
+        {
+            sdiv[i] = cvRound((255 << HSV_SHIFT) / (1. * i));
+            hdiv[i] = cvRound((180 << HSV_SHIFT) / (6. * i));
+        }
+    }
+};
+
+inline const Tables &tables()
+{
+    static const Tables t;
+    return t;
+}
+
+// Hue and mask of pixel i of a BGR row.
+inline void pixel(const uchar *bgr, uchar *hue, uchar *mask, int i, const Limits &lim, const Tables &tab)
+{
+    int b = bgr[3*i], g = bgr[3*i+1], r = bgr[3*i+2];
+    int v = std::max(b, std::max(g, r));
+    int vmin = std::min(b, std::min(g, r));
+    int diff = v - vmin;
+    int vr = v == r ? -1 : 0;
+    int vg = v == g ? -1 : 0;
+    int s = (diff * tab.sdiv[v] + (1 << (HSV_SHIFT-1))) >> HSV_SHIFT;
+    int h = (vr & (g - b)) +
+            (~vr & ((vg & (b - r + 2 * diff)) + ((~vg) & (r - g + 4 * diff))));
+
+    h = (h * tab.hdiv[diff] + (1 << (HSV_SHIFT-1))) >> HSV_SHIFT;
+    h += h < 0 ? 180 : 0;
+
+    hue[i] = (uchar)h;
+    mask[i] = (s >= lim.smin && v >= lim.vlo && v <= lim.vhi) ? 255 : 0;
+}
+
+inline void row_scalar(const uchar *bgr, uchar *hue, uchar *mask, int n, const Limits &lim)
+{
+    const Tables &tab = tables();
+
+    for (int i = 0; i < n; ++i)
+        pixel(bgr, hue, mask, i, lim, tab);
+}
+
+#if HUE_MASK_X86
+
+// Vector kernels read 4 bytes per pixel, so they leave at least the last
+// pixel of a row to the scalar loop to stay inside the image.
+
+__attribute__((target("avx2")))
+inline void row_avx2(const uchar *bgr, uchar *hue, uchar *mask, int n, const Limits &lim)
+{
+    const Tables    &tab = tables();
+    const __m256i   offs = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    const __m256i   byte = _mm256_set1_epi32(0xff);
+    const __m256i   round = _mm256_set1_epi32(1 << (HSV_SHIFT-1));
+    const __m256i   smin = _mm256_set1_epi32(lim.smin - 1);
+    const __m256i   vlo = _mm256_set1_epi32(lim.vlo - 1);
+    const __m256i   vhi = _mm256_set1_epi32(lim.vhi + 1);
+    const __m256i   hr = _mm256_set1_epi32(180);
+    int             i = 0;
+
+    for (; i + 8 < n; i += 8)
+    {
+        __m256i px = _mm256_i32gather_epi32((const int *)(bgr + 3*i), offs, 1);
+        __m256i b = _mm256_and_si256(px, byte);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi32(px, 8), byte);
+        __m256i r = _mm256_and_si256(_mm256_srli_epi32(px, 16), byte);
+
+        __m256i v = _mm256_max_epi32(b, _mm256_max_epi32(g, r));
+        __m256i diff = _mm256_sub_epi32(v, _mm256_min_epi32(b, _mm256_min_epi32(g, r)));
+        __m256i vr = _mm256_cmpeq_epi32(v, r);
+        __m256i vg = _mm256_cmpeq_epi32(v, g);
+
+        __m256i s = _mm256_i32gather_epi32(tab.sdiv, v, 4);
+        s = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(diff, s), round), HSV_SHIFT);
+
+        __m256i d2 = _mm256_add_epi32(diff, diff);
+        __m256i hg = _mm256_add_epi32(_mm256_sub_epi32(b, r), d2);
+        __m256i hb = _mm256_add_epi32(_mm256_sub_epi32(r, g), _mm256_add_epi32(d2, d2));
+        __m256i h = _mm256_or_si256(_mm256_and_si256(vr, _mm256_sub_epi32(g, b)),
+                                    _mm256_andnot_si256(vr, _mm256_or_si256(_mm256_and_si256(vg, hg),
+                                                                            _mm256_andnot_si256(vg, hb))));
+        __m256i hdiv = _mm256_i32gather_epi32(tab.hdiv, diff, 4);
+        h = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(h, hdiv), round), HSV_SHIFT);
+        h = _mm256_add_epi32(h, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), h), hr));
+
+        __m256i m = _mm256_and_si256(_mm256_cmpgt_epi32(s, smin),
+                    _mm256_and_si256(_mm256_cmpgt_epi32(v, vlo), _mm256_cmpgt_epi32(vhi, v)));
+        m = _mm256_and_si256(m, byte);
+
+        // 8 x 32 bit -> 8 bytes
+        __m256i h8 = _mm256_packus_epi16(_mm256_packs_epi32(h, h), _mm256_setzero_si256());
+        __m256i m8 = _mm256_packus_epi16(_mm256_packs_epi32(m, m), _mm256_setzero_si256());
+        _mm_storel_epi64((__m128i *)(hue + i),
+                         _mm_unpacklo_epi32(_mm256_castsi256_si128(h8), _mm256_extracti128_si256(h8, 1)));
+        _mm_storel_epi64((__m128i *)(mask + i),
+                         _mm_unpacklo_epi32(_mm256_castsi256_si128(m8), _mm256_extracti128_si256(m8, 1)));
+    }
+
+    for (; i < n; ++i)
+        pixel(bgr, hue, mask, i, lim, tab);
+}
+
+__attribute__((target("sse4.1")))
+inline void row_sse41(const uchar *bgr, uchar *hue, uchar *mask, int n, const Limits &lim)
+{
+    const Tables    &tab = tables();
+    const __m128i   byte = _mm_set1_epi32(0xff);
+    const __m128i   round = _mm_set1_epi32(1 << (HSV_SHIFT-1));
+    const __m128i   smin = _mm_set1_epi32(lim.smin - 1);
+    const __m128i   vlo = _mm_set1_epi32(lim.vlo - 1);
+    const __m128i   vhi = _mm_set1_epi32(lim.vhi + 1);
+    const __m128i   hr = _mm_set1_epi32(180);
+    int             i = 0;
+
+    for (; i + 4 < n; i += 4)
+    {
+        int     p[4];
+        int     idx[4];
+
+        for (int k = 0; k < 4; ++k)
+            std::copy(bgr + 3*(i+k), bgr + 3*(i+k) + 4, (uchar *)&p[k]);
+
+        __m128i px = _mm_loadu_si128((const __m128i *)p);
+        __m128i b = _mm_and_si128(px, byte);
+        __m128i g = _mm_and_si128(_mm_srli_epi32(px, 8), byte);
+        __m128i r = _mm_and_si128(_mm_srli_epi32(px, 16), byte);
+
+        __m128i v = _mm_max_epi32(b, _mm_max_epi32(g, r));
+        __m128i diff = _mm_sub_epi32(v, _mm_min_epi32(b, _mm_min_epi32(g, r)));
+        __m128i vr = _mm_cmpeq_epi32(v, r);
+        __m128i vg = _mm_cmpeq_epi32(v, g);
+
+        _mm_storeu_si128((__m128i *)idx, v);
+        __m128i s = _mm_setr_epi32(tab.sdiv[idx[0]], tab.sdiv[idx[1]], tab.sdiv[idx[2]], tab.sdiv[idx[3]]);
+        s = _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(diff, s), round), HSV_SHIFT);
+
+        __m128i d2 = _mm_add_epi32(diff, diff);
+        __m128i hg = _mm_add_epi32(_mm_sub_epi32(b, r), d2);
+        __m128i hb = _mm_add_epi32(_mm_sub_epi32(r, g), _mm_add_epi32(d2, d2));
+        __m128i h = _mm_or_si128(_mm_and_si128(vr, _mm_sub_epi32(g, b)),
+                                 _mm_andnot_si128(vr, _mm_or_si128(_mm_and_si128(vg, hg),
+                                                                   _mm_andnot_si128(vg, hb))));
+        _mm_storeu_si128((__m128i *)idx, diff);
+        __m128i hdiv = _mm_setr_epi32(tab.hdiv[idx[0]], tab.hdiv[idx[1]], tab.hdiv[idx[2]], tab.hdiv[idx[3]]);
+        h = _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(h, hdiv), round), HSV_SHIFT);
+        h = _mm_add_epi32(h, _mm_and_si128(_mm_cmpgt_epi32(_mm_setzero_si128(), h), hr));
+
+        __m128i m = _mm_and_si128(_mm_cmpgt_epi32(s, smin),
+                    _mm_and_si128(_mm_cmpgt_epi32(v, vlo), _mm_cmpgt_epi32(vhi, v)));
+        m = _mm_and_si128(m, byte);
+
+        // 4 x 32 bit -> 4 bytes
+        int h4 = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(h, h), h));
+        int m4 = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(m, m), m));
+        std::copy((const uchar *)&h4, (const uchar *)&h4 + 4, hue + i);
+        std::copy((const uchar *)&m4, (const uchar *)&m4 + 4, mask + i);
+    }
+
+    for (; i < n; ++i)
+        pixel(bgr, hue, mask, i, lim, tab);
+}
+
+#endif
+
+typedef void (*RowKernel)(const uchar *bgr, uchar *hue, uchar *mask, int n, const Limits &lim);
+
+// Fastest row kernel the CPU supports, chosen once.
+inline RowKernel row_kernel()
+{
+#if HUE_MASK_X86
+    static const RowKernel kernel = __builtin_cpu_supports("avx2") ? row_avx2 :
+                                    __builtin_cpu_supports("sse4.1") ? row_sse41 : row_scalar;
+    return kernel;
+#else
+    return row_scalar;
+#endif
+}
+
+/**
+ * Computes hue and mask of the 8 bit BGR image, see above. hue and mask are
+ * (re)allocated as 8 bit single channel images of the size of bgr.
+ */
+inline void hue_mask(const Mat &bgr, Mat &hue, Mat &mask, int smin, int vmin, int vmax)
+{
+    CV_Assert(bgr.type() == CV_8UC3);
+
+    Limits      lim(smin, vmin, vmax);
+    RowKernel   kernel = row_kernel();
+
+    hue.create(bgr.size(), CV_8UC1);
+    mask.create(bgr.size(), CV_8UC1);
+
+    for (int y = 0; y < bgr.rows; ++y)
+        kernel(bgr.ptr<uchar>(y), hue.ptr<uchar>(y), mask.ptr<uchar>(y), bgr.cols, lim);
+}
+
+}
+
+#endif
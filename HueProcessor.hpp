@@ -0,0 +1,100 @@
+#ifndef __HUE_PROCESSOR_HPP__
+#define __HUE_PROCESSOR_HPP__
+
+#include "HueMask.hpp"
+#include "MomentShift.hpp"
+#include "VideoProcessor.hpp"
+
+/**
+ * Base of the processors CamShifting hue histograms. Holds the S/V
+ * thresholds and the hue plane and mask of the frame, which the pipeline
+ * converts ahead of process_frame, see prepare_frame().
+ */
+class HueProcessor : public VideoProcessor
+{
+
+public:
+
+    HueProcessor(VideoCapture &Frames, string WindowName)
+    :   VideoProcessor(Frames, WindowName),
+        smin(30),
+        vmin(10),
+        vmax(256),
+        hsize(16),
+        use_pyramid(false),
+        phranges(hranges)
+    {
+        hranges[0] = 0;
+        hranges[1] = 180;
+    }
+
+    // Thresholds are read from the pipeline thread and must not change
+    // while playing.
+    void SetThresholds(int VMin, int VMax, int SMin)
+    {
+        vmin = VMin;
+        vmax = VMax;
+        smin = SMin;
+        thresholds_changed();
+    }
+
+    // Converges CamShift on a downscaled backprojection before refining at
+    // full resolution when the window is large, see pyramid_cam_shift().
+    void SetPyramid(bool Enable)
+    {
+        use_pyramid = Enable;
+    }
+
+
+protected:
+
+    int         smin;
+    int         vmin;
+    int         vmax;
+    int         hsize;
+    Mat         hue;
+    Mat         mask;
+    bool        use_pyramid;
+    float       hranges[2];
+    const float *phranges;
+
+
+    // Called when SetThresholds changed smin, vmin or vmax.
+    virtual void thresholds_changed()
+    {
+    }
+
+    // Moves the hue and mask converted ahead on the pipeline into hue and
+    // mask. Returns false when the frame was not converted ahead.
+    bool take_prepared()
+    {
+        if (planes.size() != 2)
+            return false;
+
+        std::swap(hue, planes[0]);
+        std::swap(mask, planes[1]);
+        return true;
+    }
+
+    // CamShift of Window in Weights, coarse to fine in pyramid mode except
+    // at minimal effort, where the two plain steps camshift_iterations()
+    // allows read less than downscaling the search area. Iterations
+    // receives the mean shift steps.
+    RotatedRect cam_shift(const Mat &Weights, Rect &Window, int *Iterations)
+    {
+        TermCriteria term(CV_TERMCRIT_EPS | CV_TERMCRIT_ITER, camshift_iterations(), 1);
+
+        if (use_pyramid && effort() != MINIMAL_EFFORT)
+            return MomentShift::pyramid_cam_shift(Weights, Window, term, 2, Iterations);
+        return MomentShift::cam_shift(Weights, Window, term, Iterations);
+    }
+
+    // Hue and mask of the whole frame for the pipeline.
+    virtual void prepare_frame(Mat Image, vector<Mat> &Planes)
+    {
+        Planes.resize(2);
+        HueMask::hue_mask(Image, Planes[0], Planes[1], smin, vmin, vmax);
+    }
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef __JOB_SCHEDULER_HPP__
+#define __JOB_SCHEDULER_HPP__
+
+#include <algorithm> // std::max
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Runs independent jobs on all cores with work stealing.
+ *
+ * Jobs are dealt round robin onto one deque per worker. A worker runs jobs
+ * from the back of its own deque and, once that is empty, steals from the
+ * front of the others, so workers that drew short jobs take over queued
+ * work from those stuck on long ones instead of idling.
+ */
+class JobScheduler
+{
+public:
+
+    struct Job
+    {
+        virtual ~Job()
+        {
+        }
+
+        // Called on a worker thread, Worker is its index. Jobs catch what
+        // they can report themselves, anything else is printed.
+        virtual void run(size_t Worker) = 0;
+    };
+
+    // Workers = 0 uses one per hardware thread.
+    JobScheduler(size_t Workers = 0)
+    :   queues(Workers ? Workers : std::max(thread::hardware_concurrency(), 1u)),
+        next(0),
+        stolen(0)
+    {
+    }
+
+    size_t workers() const
+    {
+        return queues.size();
+    }
+
+    // Queues a job for the next run(), the scheduler does not own it.
+    void submit(Job *J)
+    {
+        queues[next].jobs.push_back(J);
+        next = (next + 1) % queues.size();
+    }
+
+    // Runs all submitted jobs and returns when they are done.
+    void run()
+    {
+        vector<thread> pool;
+
+        for (size_t i = 0; i < queues.size(); ++i)
+            pool.push_back(thread(&JobScheduler::work, this, i));
+        for (size_t i = 0; i < pool.size(); ++i)
+            pool[i].join();
+    }
+
+    // Jobs run by a worker other than the one they were dealt to.
+    size_t steals() const
+    {
+        return stolen.load();
+    }
+
+private:
+
+    struct Queue
+    {
+        mutex           guard;
+        deque<Job *>    jobs;
+    };
+
+    // sized once, Queue holds a mutex and cannot be copied
+    vector<Queue>   queues;
+    size_t          next;
+    atomic<size_t>  stolen;
+
+    Job *pop(size_t Worker)
+    {
+        Queue &q = queues[Worker];
+        lock_guard<mutex> lock(q.guard);
+
+        if (q.jobs.empty())
+            return NULL;
+
+        Job *j = q.jobs.back();
+        q.jobs.pop_back();
+        return j;
+    }
+
+    Job *steal(size_t Worker)
+    {
+        for (size_t k = 1; k < queues.size(); ++k)
+        {
+            Queue &q = queues[(Worker + k) % queues.size()];
+            lock_guard<mutex> lock(q.guard);
+
+            if (!q.jobs.empty())
+            {
+                Job *j = q.jobs.front();
+                q.jobs.pop_front();
+                ++stolen;
+                return j;
+            }
+        }
+        return NULL;
+    }
+
+    // No jobs are added while running, so a worker that finds every deque
+    // empty is done.
+    void work(size_t Worker)
+    {
+        Job *j;
+
+        while ((j = pop(Worker)) || (j = steal(Worker)))
+        {
+            // escaping a worker thread would terminate the process
+            try
+            {
+                j->run(Worker);
+            }
+            catch (const std::exception &e)
+            {
+                cout << "Job failed: " << e.what() << endl;
+            }
+        }
+    }
+};
+
+#endif
@@ -1,5 +1,17 @@
+#ifndef __LSFIT_HPP__
+#define __LSFIT_HPP__
+
 #include "opencv2/opencv.hpp"
 
+#include "Ring.hpp"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
 using namespace cv;
 
 namespace LS {
@@ -13,29 +25,376 @@ enum CurveDegree {
     CURVE_DEG_QUINT
 };
 
-template<int D, typename X, typename Y>
-class LSFit
+/**
+ * Horner evaluation of the D coefficients c[0] + c[1] t + ... + c[D-1] t^(D-1),
+ * unrolled at compile time for a CurveDegree.
+ */
+template<int D>
+struct Horner
+{
+    template<typename T>
+    static T eval(const T* c, T t) {
+        return c[0] + t * Horner<D-1>::eval(c + 1, t);
+    }
+
+#if defined(__SSE__)
+    static __m128 eval(const __m128* c, __m128 t) {
+        return _mm_add_ps(c[0], _mm_mul_ps(t, Horner<D-1>::eval(c + 1, t)));
+    }
+#endif
+#if defined(__AVX__)
+    static __m256 eval(const __m256* c, __m256 t) {
+        return _mm256_add_ps(c[0], _mm256_mul_ps(t, Horner<D-1>::eval(c + 1, t)));
+    }
+#endif
+};
+
+template<>
+struct Horner<1>
+{
+    template<typename T>
+    static T eval(const T* c, T) {
+        return c[0];
+    }
+};
+
+/**
+ * Evaluates the polynomial at t0 + i * dt for i < count into out.
+ */
+template<int D, typename Y>
+struct HornerRange
+{
+    static void eval(const Y* c, double t0, double dt, int count, Y* out) {
+        for (int i = 0; i < count; ++i)
+            out[i] = Horner<D>::eval(c, Y(t0 + i * dt));
+    }
+};
+
+// Single precision ranges evaluate 8 (AVX) or 4 (SSE) abscissas per step.
+template<int D>
+struct HornerRange<D, float>
+{
+    static void eval(const float* c, double t0, double dt, int count, float* out) {
+        int i = 0;
+#if defined(__AVX__)
+        __m256 c8[D];
+        for (int d = 0; d < D; ++d)
+            c8[d] = _mm256_set1_ps(c[d]);
+        const __m256 lane8 = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+        for (; i + 8 <= count; i += 8) {
+            __m256 t = _mm256_add_ps(_mm256_set1_ps(float(t0 + i * dt)),
+                                     _mm256_mul_ps(lane8, _mm256_set1_ps(float(dt))));
+            _mm256_storeu_ps(out + i, Horner<D>::eval(c8, t));
+        }
+#endif
+#if defined(__SSE__)
+        __m128 c4[D];
+        for (int d = 0; d < D; ++d)
+            c4[d] = _mm_set1_ps(c[d]);
+        const __m128 lane4 = _mm_setr_ps(0, 1, 2, 3);
+        for (; i + 4 <= count; i += 4) {
+            __m128 t = _mm_add_ps(_mm_set1_ps(float(t0 + i * dt)),
+                                  _mm_mul_ps(lane4, _mm_set1_ps(float(dt))));
+            _mm_storeu_ps(out + i, Horner<D>::eval(c4, t));
+        }
+#endif
+        for (; i < count; ++i)
+            out[i] = Horner<D>::eval(c, float(t0 + i * dt));
+    }
+};
+
+/**
+ * Least squares polynomial fit of D coefficients to N ordinates sharing one
+ * abscissa, e.g. the x and y trajectory of a target over the frame number.
+ *
+ * Axes fitted over the same samples share a group, which is factorized once
+ * and solved for all of its axes as columns of one right-hand side. Each
+ * axis can be cleared on its own; it then starts a new group, and groups
+ * merge again once eviction leaves them with the same samples.
+ *
+ * A group fits the basis ((x - origin) / span)^d where origin is its oldest
+ * sample at the last rebase and span a power of two covering its samples.
+ * In incremental mode the normal equations are accumulated per sample and
+ * only the DxD system is solved, making a push O(D^2) independent of the
+ * history length. The batch mode rebuilds and QR-solves the whole design
+ * matrix and yields the same coefficients.
+ *
+ * With a capacity the fit covers only the latest samples. The oldest sample
+ * is downdated out of the normal equations when it leaves the window, and
+ * a group is rebuilt from the window once every capacity evictions to
+ * rebase its origin and discard accumulated rounding.
+ */
+template<int D, int N, typename X, typename Y>
+class LSFitN
 {
 public:
 
-    LSFit(bool w = false)
+    LSFitN(bool w = false, bool inc = false, size_t cap = 0)
         :   weighted(w),
-            coef(D, 1, DataType<Y>::type)
+            incremental(inc),
+            capacity(cap),
+            xs(cap),
+            ys(cap)
     {
+        clear();
     }
 
     void solve_ls() {
-        size_t n = ys.size();
+        for (size_t g = 0; g < groups.size(); ++g) {
+            const Group& grp = groups[g];
+            if (samples(grp) == 0)
+                continue;
+            Mat sol = incremental ? solve_normal(grp) : solve_batch(grp);
+            sol.convertTo(sol, DataType<double>::type);
+            for (int j = 0; j < N; ++j) {
+                if (group_of[j] != g)
+                    continue;
+                for (int d = 0; d < D; ++d)
+                    coef[j][d] = Y(sol.at<double>(d, j));
+                origin[j] = grp.origin;
+                span[j] = grp.span;
+            }
+        }
+    }
+
+    // Number of samples in the window.
+    size_t size() const {
+        return xs.size();
+    }
+
+    // Number of samples fitted on one axis.
+    size_t size(int axis) const {
+        return samples(groups[group_of[axis]]);
+    }
+
+    // i-th sample fitted on one axis.
+    Y at(int axis, size_t i) const {
+        return ys[first(groups[group_of[axis]]) - oldest() + i][axis];
+    }
+
+    void push_back(X x, const Vec<Y, N>& y, bool solve = true) {
+        if (xs.full()) {
+            if (incremental) {
+                for (size_t g = 0; g < groups.size(); ++g) {
+                    if (groups[g].start <= oldest())
+                        update(groups[g], 0, -1);
+                }
+            }
+            xs.pop_front();
+            ys.pop_front();
+            merge();
+        }
+        xs.push_back(x);
+        ys.push_back(y);
+        ++pushed;
+
+        for (size_t g = 0; g < groups.size(); ++g) {
+            Group& grp = groups[g];
+            if (samples(grp) == 1 || (capacity && first(grp) - grp.base >= capacity)
+                    || std::abs(double(x - grp.origin)) > grp.span)
+                rebase(grp);
+            else if (incremental)
+                update(grp, xs.size() - 1, 1);
+        }
+
+        if (solve)
+            solve_ls();
+    }
+
+    void clear() {
+        xs.clear();
+        ys.clear();
+        pushed = 0;
+        groups.assign(1, Group());
+        for (int j = 0; j < N; ++j)
+            reset(j, 0);
+    }
+
+    // Restart the fit of one axis from the next sample on.
+    void clear(int axis) {
+        size_t g = 0;
+        while (g < groups.size() && groups[g].start != pushed)
+            ++g;
+        if (g == groups.size())
+            groups.push_back(Group(pushed));
+        reset(axis, g);
+        prune();
+    }
+
+    const Y interpolate(int axis, const X& x) const {
+        return Horner<D>::eval(coef[axis], Y(double(x - origin[axis]) / span[axis]));
+    }
+
+    // Evaluates one axis at x0, x0 + 1, ..., x0 + count - 1 into out.
+    void interpolate(int axis, const X& x0, int count, Y* out) const {
+        HornerRange<D, Y>::eval(coef[axis], double(x0 - origin[axis]) / span[axis],
+                                1. / span[axis], count, out);
+    }
+
+    const Vec<Y, N> interpolate(const X& x) const {
+        Vec<Y, N> v;
+        for (int j = 0; j < N; ++j)
+            v[j] = interpolate(j, x);
+        return v;
+    }
+
+    const Vec<Y, N> operator[](const X& x) const {
+        return interpolate(x);
+    }
+private:
+
+    // Normal equations over the samples from start on. The moments run over
+    // the sample sequence number k relative to base; window position
+    // i = k - s of the first sample s carries the weight (i/4)^2, so the
+    // weighted system is (S2 - 2sS1 + s^2S0) / 16 plus the first sample at
+    // weight 1. Only lower triangles of the S matrices are kept.
+    struct Group
+    {
+        Group(size_t first = 0)
+            :   start(first),
+                base(first),
+                origin(0),
+                span(1),
+                s0(Matx<double, D, D>::zeros()), s1(s0), s2(s0),
+                b0(Matx<double, D, N>::zeros()), b1(b0), b2(b0)
+        {
+        }
+
+        size_t start; // sequence number of the first sample
+        size_t base; // sequence number of the origin sample
+        X origin;
+        double span;
+        Matx<double, D, D> s0, s1, s2;
+        Matx<double, D, N> b0, b1, b2;
+    };
+
+    bool weighted;
+    bool incremental;
+    size_t capacity; // 0 for an unbounded history
+    Ring<X> xs;
+    Ring<Vec<Y, N> > ys;
+    size_t pushed; // sequence number of the next sample
+    vector<Group> groups;
+    size_t group_of[N];
+    Y coef[N][D]; // per axis, lowest degree first
+    X origin[N]; // basis each row of coef was solved in
+    double span[N];
+
+    size_t oldest() const {
+        return pushed - xs.size();
+    }
+
+    size_t first(const Group& g) const {
+        return std::max(g.start, oldest());
+    }
+
+    size_t samples(const Group& g) const {
+        return pushed - first(g);
+    }
+
+    void reset(int axis, size_t g) {
+        group_of[axis] = g;
+        for (int d = 0; d < D; ++d)
+            coef[axis][d] = Y(0);
+        origin[axis] = X(0);
+        span[axis] = 1;
+    }
+
+    void basis(const Group& g, size_t i, double a[D]) const {
+        double t = double(xs[i] - g.origin) / g.span;
+        a[0] = 1;
+        for (int d = 1; d < D; ++d)
+            a[d] = a[d-1] * t;
+    }
+
+    // Rank-1 update (sign 1) or downdate (sign -1) with window sample i.
+    void update(Group& g, size_t i, double sign) {
+        double a[D];
+        basis(g, i, a);
+        double k = double(oldest() + i - g.base);
+        for (int r = 0; r < D; ++r) {
+            for (int c = 0; c <= r; ++c) {
+                double p = sign * a[r] * a[c];
+                g.s0(r, c) += p;
+                if (weighted) {
+                    g.s1(r, c) += k * p;
+                    g.s2(r, c) += k * k * p;
+                }
+            }
+            for (int j = 0; j < N; ++j) {
+                double p = sign * a[r] * ys[i][j];
+                g.b0(r, j) += p;
+                if (weighted) {
+                    g.b1(r, j) += k * p;
+                    g.b2(r, j) += k * k * p;
+                }
+            }
+        }
+    }
+
+    // Groups whose start fell out of the window fit the same samples.
+    void merge() {
+        size_t keep = 0;
+        while (keep < groups.size() && groups[keep].start > oldest())
+            ++keep;
+        for (int j = 0; j < N; ++j) {
+            if (groups[group_of[j]].start <= oldest())
+                group_of[j] = keep;
+        }
+        prune();
+    }
+
+    // Drop groups no axis is fitted in.
+    void prune() {
+        for (size_t g = groups.size(); g-- > 0;) {
+            bool used = false;
+            for (int j = 0; j < N; ++j)
+                used = used || group_of[j] == g;
+            if (used)
+                continue;
+            groups.erase(groups.begin() + g);
+            for (int j = 0; j < N; ++j) {
+                if (group_of[j] > g)
+                    --group_of[j];
+            }
+        }
+    }
+
+    // Move the origin to the first sample, refit the span to the samples and
+    // rebuild the normal equations. Triggered once per capacity evictions or
+    // when the span doubles, so the amortized cost per sample stays O(D^2).
+    void rebase(Group& g) {
+        size_t i0 = first(g) - oldest();
+        g.base = first(g);
+        g.origin = xs[i0];
+        g.span = 1;
+        for (size_t i = i0; i < xs.size(); ++i) {
+            while (g.span < std::abs(double(xs[i] - g.origin)))
+                g.span *= 2;
+        }
+        if (!incremental)
+            return;
+        g.s0 = g.s1 = g.s2 = Matx<double, D, D>::zeros();
+        g.b0 = g.b1 = g.b2 = Matx<double, D, N>::zeros();
+        for (size_t i = i0; i < xs.size(); ++i)
+            update(g, i, 1);
+    }
+
+    Mat solve_batch(const Group& g) const {
+        size_t n = samples(g);
+        size_t i0 = first(g) - oldest();
         int dim = n < D ? n : D;
-        if (n < D || coef.rows < dim)
-            coef.resize(dim, 0);
 
         Mat x(n, dim, DataType<Y>::type);
-        Mat y(ys, weighted); // need a copy of data when using weights
+        Mat y(n, N, DataType<Y>::type);
 
         x.col(0) = Scalar(1);
-        if (dim > 1)
-            Mat(xs, weighted).convertTo(x.col(1), DataType<Y>::type);
+        for (int i = 0; i < n; ++i) {
+            if (dim > 1)
+                x.at<Y>(i, 1) = Y(double(xs[i0 + i] - g.origin) / g.span);
+            for (int j = 0; j < N; ++j)
+                y.at<Y>(i, j) = ys[i0 + i][j];
+        }
         for (int d = 2; d < dim; ++d)
             pow(x.col(1), d, x.col(d));
 
@@ -45,44 +404,92 @@ public:
                 y.row(i) *= i * 0.25;
             }
         }
-        solve(x, y, coef, DECOMP_QR); // alternatively DECOMP_SVD
+        Mat c, sol = Mat::zeros(D, N, DataType<Y>::type);
+        solve(x, y, c, DECOMP_QR); // alternatively DECOMP_SVD
+        c.copyTo(sol.rowRange(0, dim));
+        return sol;
     }
 
-    size_t size() {
-        return ys.size();
+    Mat solve_normal(const Group& g) const {
+        size_t n = samples(g);
+        int dim = n < D ? n : D;
+
+        Matx<double, D, D> ata = g.s0;
+        Matx<double, D, N> aty = g.b0;
+        if (weighted) {
+            size_t i0 = first(g) - oldest();
+            double s = double(first(g) - g.base);
+            double a0[D];
+            basis(g, i0, a0);
+            for (int r = 0; r < D; ++r) {
+                for (int c = 0; c <= r; ++c)
+                    ata(r, c) = (g.s2(r, c) - 2 * s * g.s1(r, c) + s * s * g.s0(r, c)) / 16
+                              + a0[r] * a0[c];
+                for (int j = 0; j < N; ++j)
+                    aty(r, j) = (g.b2(r, j) - 2 * s * g.b1(r, j) + s * s * g.b0(r, j)) / 16
+                              + a0[r] * ys[i0][j];
+            }
+        }
+
+        // unused coefficients are pinned to zero by an identity block
+        Matx<double, D, D> a;
+        Matx<double, D, N> b;
+        for (int r = 0; r < D; ++r) {
+            for (int c = 0; c <= r; ++c) {
+                double v = r < dim ? ata(r, c) : (r == c ? 1 : 0);
+                a(r, c) = v;
+                a(c, r) = v;
+            }
+            for (int j = 0; j < N; ++j)
+                b(r, j) = r < dim ? aty(r, j) : 0;
+        }
+
+        Mat sol;
+        if (!solve(Mat(a, false), Mat(b, false), sol, DECOMP_CHOLESKY))
+            solve(Mat(a, false), Mat(b, false), sol, DECOMP_SVD);
+        return sol;
     }
+};
+
+/**
+ * Least squares polynomial fit of a single ordinate, see LSFitN.
+ */
+template<int D, typename X, typename Y>
+class LSFit : public LSFitN<D, 1, X, Y>
+{
+    typedef LSFitN<D, 1, X, Y> Base;
+public:
 
-    Y at(size_t i) {
-        return ys[i];
+    LSFit(bool w = false, bool inc = false, size_t cap = 0)
+        :   Base(w, inc, cap)
+    {
     }
 
-    void push_back(X x, Y y, bool solve = true) {
-        xs.push_back(x);
-        ys.push_back(y);
-        if (solve)
-            solve_ls();
+    size_t size() const {
+        return Base::size(0);
     }
 
-    void clear() {
-        xs.clear();
-        ys.clear();
+    Y at(size_t i) const {
+        return Base::at(0, i);
+    }
+
+    void push_back(X x, Y y, bool solve = true) {
+        Base::push_back(x, Vec<Y, 1>(y), solve);
     }
 
     const Y interpolate(const X& x) const {
-        Y sum(0);
-        for (size_t d = 0; d < coef.rows; ++d)
-            sum += coef.at<Y>(d, 0) * pow(x, d);
-        return sum;
+        return Base::interpolate(0, x);
+    }
+
+    void interpolate(const X& x0, int count, Y* out) const {
+        Base::interpolate(0, x0, count, out);
     }
 
     const Y operator[](const X& x) const {
         return interpolate(x);
     }
-private:
-    bool weighted;
-    vector<X> xs;
-    vector<Y> ys;
-    Mat coef;
 };
 
 }
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __MANIFEST_HPP__
+#define __MANIFEST_HPP__
+
+#include "opencv2/core/core.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Clip manifest for batch runs, one clip per line:
+ *
+ *   # clip            x    y    w    h   vmin vmax smin  output
+ *   clips/0001.avi    120  80   40   60  10   256  30    out/0001.csv
+ *
+ * Fields are separated by white space, blank lines and lines starting with
+ * '#' are skipped. The output receives the trajectory of the clip.
+ */
+struct ClipSpec
+{
+    string  clip;
+    Rect    selection;
+    int     vmin;
+    int     vmax;
+    int     smin;
+    string  output;
+};
+
+// Appends the clips of File to Clips. On failure Error names the line.
+inline bool read_manifest(const string &File, vector<ClipSpec> &Clips, string &Error)
+{
+    ifstream    in(File.c_str());
+    string      line;
+    int         line_no = 0;
+
+    if (!in)
+    {
+        Error = "Could not open manifest " + File;
+        return false;
+    }
+
+    while (getline(in, line))
+    {
+        ++line_no;
+
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == string::npos || line[first] == '#')
+            continue;
+
+        istringstream   fields(line);
+        ClipSpec        c;
+        string          extra;
+
+        if (!(fields >> c.clip >> c.selection.x >> c.selection.y
+                     >> c.selection.width >> c.selection.height
+                     >> c.vmin >> c.vmax >> c.smin >> c.output) ||
+            (fields >> extra) || c.selection.width <= 0 || c.selection.height <= 0)
+        {
+            ostringstream e;
+            e << File << ":" << line_no << ": expected clip x y w h vmin vmax smin output";
+            Error = e.str();
+            return false;
+        }
+
+        Clips.push_back(c);
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,442 @@
+#ifndef __MOMENT_SHIFT_HPP__
+#define __MOMENT_SHIFT_HPP__
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <algorithm>
+#include <cfloat>   // DBL_EPSILON
+#include <cmath>
+
+#if defined(__SSE2__)
+#define MOMENT_SHIFT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+/*
+ * meanShift and CamShift on 8 bit weights, with the same results as
+ * OpenCV 2.4's
+ *
+ *   int iterations = meanShift(prob, window, criteria);
+ *   RotatedRect box = CamShift(prob, window, criteria);
+ *
+ * Window moments are accumulated with SSE2 instead of cvMoments. As the
+ * moments of 8 bit weights are integers both sum them exactly, so the
+ * windows and boxes agree bit for bit.
+ *
+ * pyramid_cam_shift() trades the exactness for speed on large windows:
+ * it runs mean shift on a downscaled copy first and refines at full
+ * resolution with a few steps.
+ */
+namespace MomentShift {
+
+// Spatial moments of a window, relative to its top left corner.
+struct Moments
+{
+    Moments()
+    :   m00(0), m10(0), m01(0), m20(0), m11(0), m02(0)
+    {
+    }
+
+    double m00;
+    double m10;
+    double m01;
+    double m20;
+    double m11;
+    double m02;
+};
+
+// Pixels cam_shift looks beyond the converged window for the box
+// (TOLERANCE in cvCamShift).
+enum { TOLERANCE = 10 };
+
+// Columns summed in 32 bit before moving the offset into 64 bit. With
+// x < 128, w * x * x and the sums over a chunk stay below 2^31.
+enum { CHUNK = 128 };
+
+/**
+ * Sums of W[x], x * W[x] and x * x * W[x] over a row of N weights.
+ */
+inline void row_moments(const uchar *W, int N, int64 &S0, int64 &S1, int64 &S2)
+{
+    S0 = S1 = S2 = 0;
+
+    for (int c = 0; c < N; c += CHUNK)
+    {
+        const uchar *w = W + c;
+        int         len = std::min((int)CHUNK, N - c);
+        int         t0 = 0, t1 = 0, t2 = 0;
+        int         k = 0;
+
+#if MOMENT_SHIFT_SSE2
+        const __m128i   zero = _mm_setzero_si128();
+        const __m128i   ones = _mm_set1_epi16(1);
+        const __m128i   eight = _mm_set1_epi16(8);
+        __m128i         x = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+        __m128i         a0 = zero, a1 = zero, a2 = zero;
+
+        // 16 weights per step, widened to 16 bit and multiplied into
+        // 32 bit pair sums by madd
+        for (; k + 16 <= len; k += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(w + k));
+            __m128i lo = _mm_unpacklo_epi8(v, zero);
+            __m128i hi = _mm_unpackhi_epi8(v, zero);
+            __m128i xh = _mm_add_epi16(x, eight);
+
+            a0 = _mm_add_epi32(a0, _mm_add_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones)));
+            a1 = _mm_add_epi32(a1, _mm_add_epi32(_mm_madd_epi16(lo, x), _mm_madd_epi16(hi, xh)));
+            a2 = _mm_add_epi32(a2, _mm_add_epi32(_mm_madd_epi16(lo, _mm_mullo_epi16(x, x)),
+                                                 _mm_madd_epi16(hi, _mm_mullo_epi16(xh, xh))));
+            x = _mm_add_epi16(xh, eight);
+        }
+
+        int s[4];
+        _mm_storeu_si128((__m128i *)s, a0);
+        t0 = s[0] + s[1] + s[2] + s[3];
+        _mm_storeu_si128((__m128i *)s, a1);
+        t1 = s[0] + s[1] + s[2] + s[3];
+        _mm_storeu_si128((__m128i *)s, a2);
+        t2 = s[0] + s[1] + s[2] + s[3];
+#endif
+
+        for (; k < len; ++k)
+        {
+            t0 += w[k];
+            t1 += w[k] * k;
+            t2 += w[k] * k * k;
+        }
+
+        // shift the chunk sums from x - c to x
+        S0 += t0;
+        S1 += t1 + (int64)c * t0;
+        S2 += t2 + 2 * (int64)c * t1 + (int64)c * c * t0;
+    }
+}
+
+// Moments of the weights in Window. Second = false skips m20, m11, m02.
+inline void window_moments(const Mat &Weights, const Rect &Window, Moments &M, bool Second = true)
+{
+    int64 m00 = 0, m10 = 0, m01 = 0, m20 = 0, m11 = 0, m02 = 0;
+
+    for (int y = 0; y < Window.height; ++y)
+    {
+        int64 s0, s1, s2;
+
+        row_moments(Weights.ptr<uchar>(Window.y + y) + Window.x, Window.width, s0, s1, s2);
+        m00 += s0;
+        m10 += s1;
+        m01 += y * s0;
+        if (Second)
+        {
+            m20 += s2;
+            m11 += y * s1;
+            m02 += (int64)y * y * s0;
+        }
+    }
+
+    M.m00 = (double)m00;
+    M.m10 = (double)m10;
+    M.m01 = (double)m01;
+    M.m20 = (double)m20;
+    M.m11 = (double)m11;
+    M.m02 = (double)m02;
+}
+
+/**
+ * meanShift of OpenCV 2.4: moves Window to the centre of mass of Weights
+ * until it moves less than Criteria.epsilon or after Criteria.maxCount
+ * steps. Returns the number of steps.
+ */
+inline int mean_shift(const Mat &Weights, Rect &Window, TermCriteria Criteria)
+{
+    CV_Assert(Weights.type() == CV_8UC1);
+
+    if (Window.width <= 0 || Window.height <= 0)
+        CV_Error(CV_StsBadArg, "Input window has non-positive sizes");
+
+    Rect    frame(0, 0, Weights.cols, Weights.rows);
+    Rect    in = Window & frame;
+    Rect    cur = Window;
+    Moments m;
+
+    // cvCheckTermCriteria: defaults 1 and 100, epsilon stored as float
+    double  epsilon = (Criteria.type & CV_TERMCRIT_EPS) ? (float)std::max(Criteria.epsilon, 0.) : 1.;
+    int     eps = cvRound(epsilon * epsilon);
+    int     iterations = (Criteria.type & CV_TERMCRIT_ITER) ? std::max(Criteria.maxCount, 1) : 100;
+    int     i;
+
+    for (i = 0; i < iterations; ++i)
+    {
+        cur &= frame;
+        if (cur == Rect())
+        {
+            cur.x = Weights.cols / 2;
+            cur.y = Weights.rows / 2;
+        }
+        cur.width = std::max(cur.width, 1);
+        cur.height = std::max(cur.height, 1);
+
+        window_moments(Weights, cur, m, false);
+
+        if (std::fabs(m.m00) < DBL_EPSILON)
+            break;
+
+        // 1/m00 as cvMoments' inv_sqrt_m00 squared
+        double inv_sqrt_m00 = std::sqrt(1. / m.m00);
+        double inv_m00 = inv_sqrt_m00 * inv_sqrt_m00;
+        int    dx = cvRound(m.m10 * inv_m00 - in.width * 0.5);
+        int    dy = cvRound(m.m01 * inv_m00 - in.height * 0.5);
+        int    nx = cur.x + dx;
+        int    ny = cur.y + dy;
+
+        if (nx < 0)
+            nx = 0;
+        else if (nx + cur.width > Weights.cols)
+            nx = Weights.cols - cur.width;
+
+        if (ny < 0)
+            ny = 0;
+        else if (ny + cur.height > Weights.rows)
+            ny = Weights.rows - cur.height;
+
+        dx = nx - cur.x;
+        dy = ny - cur.y;
+        cur.x = nx;
+        cur.y = ny;
+
+        if (dx * dx + dy * dy < eps)
+            break;
+    }
+
+    Window = cur;
+    return i;
+}
+
+/**
+ * CamShift of OpenCV 2.4: mean_shift, then the box of the weights around
+ * the window. Window receives the box's upright bounds, or an empty rect
+ * together with an empty box when there is no weight left. Iterations, if
+ * given, receives the mean shift steps.
+ */
+inline RotatedRect cam_shift(const Mat &Weights, Rect &Window, TermCriteria Criteria, int *Iterations = NULL)
+{
+    int steps = mean_shift(Weights, Window, Criteria);
+    if (Iterations)
+        *Iterations = steps;
+
+    Rect w = Window;
+
+    w.x -= TOLERANCE;
+    if (w.x < 0)
+        w.x = 0;
+
+    w.y -= TOLERANCE;
+    if (w.y < 0)
+        w.y = 0;
+
+    w.width += 2 * TOLERANCE;
+    if (w.x + w.width > Weights.cols)
+        w.width = Weights.cols - w.x;
+
+    w.height += 2 * TOLERANCE;
+    if (w.y + w.height > Weights.rows)
+        w.height = Weights.rows - w.y;
+
+    Moments m;
+    window_moments(Weights, w, m);
+
+    if (std::fabs(m.m00) < DBL_EPSILON)
+    {
+        Window = Rect();
+        return RotatedRect();
+    }
+
+    // central moments as cvMoments computes them
+    double inv_m00 = 1. / m.m00;
+    double mu20 = m.m20 - m.m10 * (m.m10 * inv_m00);
+    double mu11 = m.m11 - m.m10 * (m.m01 * inv_m00);
+    double mu02 = m.m02 - m.m01 * (m.m01 * inv_m00);
+
+    int    xc = cvRound(m.m10 * inv_m00 + w.x);
+    int    yc = cvRound(m.m01 * inv_m00 + w.y);
+    double a = mu20 * inv_m00, b = mu11 * inv_m00, c = mu02 * inv_m00;
+
+    double square = std::sqrt(4 * b * b + (a - c) * (a - c));
+    double theta = std::atan2(2 * b, a - c + square);
+    double cs = std::cos(theta);
+    double sn = std::sin(theta);
+
+    double rotate_a = cs * cs * mu20 + 2 * cs * sn * mu11 + sn * sn * mu02;
+    double rotate_c = sn * sn * mu20 - 2 * cs * sn * mu11 + cs * cs * mu02;
+    double length = std::sqrt(rotate_a * inv_m00) * 4;
+    double width = std::sqrt(rotate_c * inv_m00) * 4;
+
+    // at 0 or 90 degrees length and width may come out swapped
+    if (length < width)
+    {
+        std::swap(length, width);
+        std::swap(cs, sn);
+        theta = CV_PI * 0.5 - theta;
+    }
+
+    int t0 = cvRound(std::fabs(length * cs));
+    int t1 = cvRound(std::fabs(width * sn));
+
+    t0 = std::max(t0, t1) + 2;
+    Window.width = std::min(t0, (Weights.cols - xc) * 2);
+
+    t0 = cvRound(std::fabs(length * sn));
+    t1 = cvRound(std::fabs(width * cs));
+
+    t0 = std::max(t0, t1) + 2;
+    Window.height = std::min(t0, (Weights.rows - yc) * 2);
+
+    Window.x = std::max(0, xc - Window.width / 2);
+    Window.y = std::max(0, yc - Window.height / 2);
+
+    Window.width = std::min(Weights.cols - Window.x, Window.width);
+    Window.height = std::min(Weights.rows - Window.y, Window.height);
+
+    RotatedRect box;
+
+    box.size.height = (float)length;
+    box.size.width = (float)width;
+    box.angle = (float)((CV_PI * 0.5 + theta) * 180. / CV_PI);
+    while (box.angle < 0)
+        box.angle += 360;
+    while (box.angle >= 360)
+        box.angle -= 360;
+    if (box.angle >= 180)
+        box.angle -= 180;
+    box.center = Point2f(Window.x + Window.width * 0.5f, Window.y + Window.height * 0.5f);
+
+    return box;
+}
+
+
+// Margin around Window worth searching by default. Half the window allows
+// mean shift a few steps in any direction.
+inline Size search_margin(const Rect &Window)
+{
+    return Size(Window.width / 2 + TOLERANCE, Window.height / 2 + TOLERANCE);
+}
+
+// Window grown by Margin on every side and clipped to Frame, all of Frame
+// when nothing of it is left.
+inline Rect search_area(const Rect &Window, const Size &Margin, const Rect &Frame)
+{
+    Rect area = Rect(Window.x - Margin.width, Window.y - Margin.height,
+                     Window.width + 2 * Margin.width, Window.height + 2 * Margin.height) & Frame;
+    return area.area() > 0 ? area : Frame;
+}
+
+// Window to search a target lost at Window in next, a sixth of the frame
+// around it.
+inline Rect lost_window(const Rect &Window, const Rect &Frame)
+{
+    int r = (std::min(Frame.width, Frame.height) + 5) / 6;
+    return search_area(Window, Size(r, r), Frame);
+}
+
+// A target counts as lost when the mean weight in its window falls below
+// this fraction of the mean while it was held.
+const float LOST_WEIGHT = 0.2f;
+
+// Mean weight in Window, 0 for windows CamShift collapsed.
+inline float window_weight(const Mat &Weights, const Rect &Window)
+{
+    return Window.area() > 1 ? (float)(sum(Mat(Weights, Window))[0] / Window.area()) : 0.f;
+}
+
+// Whether a window of mean weight Weight lost the target held at a mean
+// weight of Held, see hold_weight().
+inline bool lost_weight(float Weight, float Held)
+{
+    return Weight == 0 || Weight < LOST_WEIGHT * Held;
+}
+
+// Held weight after a tracked window of mean weight Weight, decaying
+// towards the recent frames. Held is 0 before the first one.
+inline float hold_weight(float Held, float Weight)
+{
+    return Held > 0 ? Held + 0.1f * (Weight - Held) : Weight;
+}
+
+
+// Smallest side of a window on the coarsest pyramid level.
+enum { PYRAMID_MIN_SIDE = 16, PYRAMID_MAX_LEVELS = 4 };
+
+// Number of times Window can be halved keeping PYRAMID_MIN_SIDE pixels.
+inline int pyramid_levels(const Rect &Window)
+{
+    int levels = 0;
+
+    while (levels < PYRAMID_MAX_LEVELS &&
+           (std::min(Window.width, Window.height) >> (levels + 1)) >= PYRAMID_MIN_SIDE)
+        ++levels;
+    return levels;
+}
+
+/**
+ * cam_shift coarse to fine. The window converges with Criteria on the
+ * search_area() around it downscaled by 2^pyramid_levels(Window), then
+ * cam_shift refines it at full resolution with at most Refine steps. Only
+ * that area is downscaled, so the cost follows the window and not the
+ * frame; mean shift cannot leave it on the coarse level. Small windows go
+ * to cam_shift directly. Iterations, if given, receives the steps of both
+ * levels.
+ */
+inline RotatedRect pyramid_cam_shift(const Mat &Weights, Rect &Window, TermCriteria Criteria,
+                                     int Refine = 2, int *Iterations = NULL)
+{
+    int     levels = pyramid_levels(Window);
+    int     f = 1 << levels;
+    int     coarse_steps = 0;
+    Rect    area;
+
+    if (levels > 0)
+    {
+        // whole f x f blocks only, so INTER_AREA averages them
+        Rect    blocks(0, 0, Weights.cols / f * f, Weights.rows / f * f);
+        Rect    reach = search_area(Window, search_margin(Window), blocks);
+        int     x1 = std::min((reach.x + reach.width + f - 1) / f * f, blocks.width);
+        int     y1 = std::min((reach.y + reach.height + f - 1) / f * f, blocks.height);
+
+        area.x = reach.x / f * f;
+        area.y = reach.y / f * f;
+        area.width = x1 - area.x;
+        area.height = y1 - area.y;
+    }
+
+    if (area.width > 0 && area.height > 0)
+    {
+        Mat     coarse;
+        Rect    w((Window.x - area.x) / f, (Window.y - area.y) / f,
+                  std::max(Window.width / f, 1), std::max(Window.height / f, 1));
+
+        resize(Weights(area), coarse, Size(area.width / f, area.height / f), 0, 0, INTER_AREA);
+        coarse_steps = mean_shift(coarse, w, Criteria);
+
+        // move the full window to the coarse centre
+        Window.x = cvRound((w.x + w.width * 0.5) * f + area.x - Window.width * 0.5);
+        Window.y = cvRound((w.y + w.height * 0.5) * f + area.y - Window.height * 0.5);
+
+        Criteria.type |= CV_TERMCRIT_ITER;
+        Criteria.maxCount = std::max(Refine, 1);
+    }
+
+    int         fine_steps = 0;
+    RotatedRect box = cam_shift(Weights, Window, Criteria, &fine_steps);
+
+    if (Iterations)
+        *Iterations = coarse_steps + fine_steps;
+    return box;
+}
+
+}
+
+#endif
@@ -0,0 +1,306 @@
+#ifndef __MULTI_TARGET_PROCESSOR_HPP__
+#define __MULTI_TARGET_PROCESSOR_HPP__
+
+#include <fstream>
+#include <vector>
+
+#include "Backproject.hpp"
+#include "HueMask.hpp"
+#include "HueProcessor.hpp"
+#include "MomentShift.hpp"
+#include "Predictor.hpp"
+#include "Trajectory.hpp"
+
+/**
+ * Tracks several targets in one stream.
+ *
+ * The hue plane and S/V mask are computed once per frame and shared. Every
+ * target has its own histogram and window and is backprojected and
+ * CamShifted around its window, the targets in parallel. Each new selection
+ * adds a target, AddTarget() adds them without one.
+ */
+class MultiTargetProcessor : public HueProcessor
+{
+
+public:
+
+    MultiTargetProcessor(VideoCapture &Frames, string WindowName)
+    :   HueProcessor(Frames, WindowName)
+    {
+    }
+
+    // Tracks the target in Selection, taking its histogram from the next
+    // frame processed.
+    void AddTarget(const Rect &Selection)
+    {
+        pending.push_back(Selection);
+    }
+
+    size_t Targets() const
+    {
+        return targets.size();
+    }
+
+    // Writes the tracked box of every target and frame to File as CSV.
+    void SetTrajectoryOutput(const string &File)
+    {
+        trajectory.open(File.c_str());
+        if (!trajectory)
+        {
+            cout << "Could not open trajectory file " << File << endl;
+        }
+        else
+        {
+            trajectory << "target,";
+            write_trajectory_header(trajectory);
+        }
+    }
+
+
+protected:
+
+    struct Target
+    {
+        Mat         hist;
+        uchar       weights[256];   // hue -> backprojection
+        Rect        window;
+        RotatedRect box;
+        Rect        roi;            // region backproj covers
+        Mat         backproj;
+        bool        lost;
+        float       held_weight;    // decaying mean weight in the window while held
+        int         iterations;     // mean shift steps of the last frame
+    };
+
+    vector<Target>  targets;
+    vector<Rect>    pending;
+    ofstream        trajectory;
+
+
+    // Window to search target Index in, called in parallel for different
+    // targets.
+    virtual Rect search_window(size_t Index, const Target &T)
+    {
+        return T.window;
+    }
+
+    // Margin around the search window that is backprojected.
+    virtual Size search_margin(size_t Index, const Rect &Window)
+    {
+        return MomentShift::search_margin(Window);
+    }
+
+    // Called in parallel for different targets once they are tracked.
+    virtual void track_results(size_t Index, const Target &T)
+    {
+    }
+
+    virtual void draw_results(Mat Image, size_t Index, const Target &T)
+    {
+        ellipse(Image, T.box, Scalar(0,0,255), 3, CV_AA);
+    }
+
+    // Called when target Index has been added, before it is tracked.
+    virtual void target_added(size_t Index)
+    {
+    }
+
+    virtual void process_frame(Mat image)
+    {
+        if (!take_prepared())
+            HueMask::hue_mask(image, hue, mask, smin, vmin, vmax);
+
+        for (size_t i = 0; i < pending.size(); ++i)
+            add_target(to_native(pending[i]));
+        pending.clear();
+
+        if (targets.empty())
+            return;
+
+        parallel_for_(Range(0, (int)targets.size()), TrackBody(*this));
+
+        for (size_t i = 0; i < targets.size(); ++i)
+        {
+            const Target &t = targets[i];
+
+            if (trajectory.is_open())
+            {
+                trajectory << i << ',';
+                write_trajectory(trajectory, TrackRecord(frameCount, to_view(t.box), t.lost));
+            }
+        }
+
+        if (backproj_mode())
+        {
+            image = Scalar::all(0);
+            for (size_t i = 0; i < targets.size(); ++i)
+            {
+                Mat view(image, targets[i].roi);
+                cvtColor(targets[i].backproj, view, CV_GRAY2BGR);
+            }
+        }
+
+        if (overlay_mode())
+            for (size_t i = 0; i < targets.size(); ++i)
+                draw_results(image, i, targets[i]);
+    }
+
+    // Headless runs start from the targets given to AddTarget, which the
+    // first frame has taken up by now.
+    virtual bool acquire_target()
+    {
+        return !targets.empty();
+    }
+
+    virtual void region_selected(const Rect &Region)
+    {
+        add_target(Region);
+    }
+
+private:
+
+    class TrackBody : public ParallelLoopBody
+    {
+    public:
+
+        TrackBody(MultiTargetProcessor &Processor)
+        :   processor(Processor)
+        {
+        }
+
+        virtual void operator()(const Range &Targets) const
+        {
+            for (int i = Targets.start; i < Targets.end; ++i)
+                processor.track(i);
+        }
+
+    private:
+
+        MultiTargetProcessor &processor;
+    };
+
+    void add_target(const Rect &Region)
+    {
+        Rect r = Region & Rect(0, 0, hue.cols, hue.rows);
+        if (r.area() == 0)
+            return;
+
+        Mat     roi(hue, r),
+                maskroi(mask, r);
+        Target  t;
+
+        calcHist(&roi, 1, 0, maskroi, t.hist, 1, &hsize, &phranges);
+        normalize(t.hist, t.hist, 0, 255, CV_MINMAX);
+        hue_weights(t.hist, phranges, t.weights);
+
+        t.window = r;
+        t.roi = r;
+        t.lost = false;
+        t.held_weight = 0;
+        t.iterations = 0;
+
+        targets.push_back(t);
+        target_added(targets.size() - 1);
+        cout << "Tracking target " << targets.size() - 1 << " at x=" << r.x << " y=" << r.y
+             << " w=" << r.width << " h=" << r.height << endl;
+    }
+
+    // Backprojects and CamShifts one target. Runs on a worker, the parallel
+    // loop is across targets so the per target work stays on one thread.
+    void track(size_t Index)
+    {
+        Target  &t = targets[Index];
+        Rect    frame(0, 0, hue.cols, hue.rows);
+
+        t.window = search_window(Index, t);
+        t.roi = frame;
+
+        // the full frame is searched again once the target is lost
+        if (!t.lost)
+            t.roi = MomentShift::search_area(t.window, search_margin(Index, t.window), frame);
+
+        masked_backproject(Mat(hue, t.roi), Mat(mask, t.roi), t.weights, t.backproj, false);
+
+        Rect window = (t.window - t.roi.tl()) & Rect(0, 0, t.roi.width, t.roi.height);
+        if (window.area() == 0)
+            window = Rect(0, 0, t.roi.width, t.roi.height);
+
+        t.box = cam_shift(t.backproj, window, &t.iterations);
+        t.box.center.x += t.roi.x;
+        t.box.center.y += t.roi.y;
+        t.window = window + t.roi.tl();
+
+        // lost as CamShiftProcessor judges it, by the weight in the window
+        float weight = MomentShift::window_weight(t.backproj, window);
+        t.lost = MomentShift::lost_weight(weight, t.held_weight);
+
+        // search a sixth of the frame around where it was lost
+        if (t.lost)
+            t.window = MomentShift::lost_window(t.window, frame);
+        else
+            t.held_weight = MomentShift::hold_weight(t.held_weight, weight);
+
+        track_results(Index, t);
+    }
+};
+
+
+/**
+ * Multi target tracking with one Predictor per target seeding its search
+ * window, as CurveFitProcessor does for a single target.
+ */
+template<class Predictor = CurvePredictor<> >
+class MultiCurveFitProcessor : public MultiTargetProcessor
+{
+public:
+
+    MultiCurveFitProcessor(VideoCapture &Frames, string WindowName,
+                           const Predictor &Pred = Predictor())
+    :   MultiTargetProcessor(Frames, WindowName),
+        prototype(Pred)
+    {
+    }
+
+protected:
+
+    Predictor           prototype;      // copied for each new target
+    vector<Predictor>   predictors;
+
+    virtual void target_added(size_t Index)
+    {
+        predictors.push_back(prototype);
+    }
+
+    virtual Rect search_window(size_t Index, const Target &T)
+    {
+        const Predictor &p = predictors[Index];
+
+        if (T.lost || p.size() == 0)
+            return T.window;
+
+        // grow the window by two standard deviations of the prediction
+        return p.predicted_window(frame_time(), T.window.size());
+    }
+
+    virtual Size search_margin(size_t Index, const Rect &Window)
+    {
+        Size m = MultiTargetProcessor::search_margin(Index, Window);
+        int e = cvCeil(2 * predictors[Index].error());
+        return Size(m.width + e, m.height + e);
+    }
+
+    virtual void track_results(size_t Index, const Target &T)
+    {
+        if (!T.lost)
+            predictors[Index].push_back(frame_time(), T.box.center);
+    }
+
+    virtual void draw_results(Mat Image, size_t Index, const Target &T)
+    {
+        MultiTargetProcessor::draw_results(Image, Index, T);
+        if (predictors[Index].size() > 0)
+            circle(Image, predictors[Index][frame_time() + 1], 4, Scalar(0,255,0), 2);
+    }
+};
+
+#endif
@@ -0,0 +1,344 @@
+#ifndef __PREDICTOR_HPP__
+#define __PREDICTOR_HPP__
+
+#include "opencv2/video/tracking.hpp"
+
+#include <cmath>
+#include <iostream>
+
+#include "CurveFit.hpp"
+#include "LSFit.hpp"
+#include "Spline.hpp"
+
+using namespace cv;
+using namespace std;
+
+// Motion predictors plugged into CurveFitProcessor, see CurveFit.hpp.
+
+
+/**
+ * Least squares fit of the recent trajectory with D coefficients, optionally
+ * weighted towards the latest positions. An axis is refitted from scratch
+ * whenever the target reverses direction on it.
+ */
+template<int D = LS::CURVE_DEG_CUBIC, bool Weighted = true>
+class CurvePredictor : public CurveFit<CurvePredictor<D, Weighted> >
+{
+public:
+
+    CurvePredictor(size_t Window = 50)
+        :   lsf(Weighted, true, Window)
+    {
+    }
+
+    void update(int frame, const Point2f &pos)
+    {
+        // clear history when radical direction changes happen
+        size_t sx = lsf.size(0);
+        size_t sy = lsf.size(1);
+        if (sx >= 2 && (lsf.at(0, sx-1) - lsf.at(0, sx-2)) * (pos.x - lsf.at(0, sx-1)) < -2) {
+            cout << "cleared x: " << lsf.at(0, sx-2) << ", " << lsf.at(0, sx-1) << ", " << pos.x << endl;
+            lsf.clear(0);
+        }
+        if (sy >= 2 && (lsf.at(1, sy-1) - lsf.at(1, sy-2)) * (pos.y - lsf.at(1, sy-1)) < -2) {
+            cout << "cleared y: " << lsf.at(1, sy-2) << ", " << lsf.at(1, sy-1) << ", " << pos.y << endl;
+            lsf.clear(1);
+        }
+
+        lsf.push_back(frame, Vec2f(pos.x, pos.y));
+    }
+
+    Point2f predict(int frame) const
+    {
+        Vec2f v = lsf[frame];
+        return Point2f(v[0], v[1]);
+    }
+
+    void interpolate(int frame, int count, float *xs, float *ys) const
+    {
+        lsf.interpolate(0, frame, count, xs);
+        lsf.interpolate(1, frame, count, ys);
+    }
+
+    // The fit reports no uncertainty; search windows keep the tracked size.
+    Size2f spread(int frame) const
+    {
+        return Size2f(0, 0);
+    }
+
+    size_t size() const
+    {
+        return lsf.size();
+    }
+
+    void reset()
+    {
+        lsf.clear();
+    }
+
+private:
+
+    LS::LSFitN<D, 2, int, float> lsf; // x and y over frame
+};
+
+
+/**
+ * Cubic Hermite spline through the recent trajectory, continued along the
+ * end tangent for future frames.
+ */
+class SplinePredictor : public CurveFit<SplinePredictor>
+{
+public:
+
+    SplinePredictor(size_t Window = 50)
+        :   spl_x(Window),
+            spl_y(Window)
+    {
+    }
+
+    void update(int frame, const Point2f &pos)
+    {
+        spl_x.push_back(frame, pos.x);
+        spl_y.push_back(frame, pos.y);
+    }
+
+    Point2f predict(int frame) const
+    {
+        return Point2f(spl_x[frame], spl_y[frame]);
+    }
+
+    void interpolate(int frame, int count, float *xs, float *ys) const
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            xs[i] = spl_x[frame + i];
+            ys[i] = spl_y[frame + i];
+        }
+    }
+
+    // The spline reports no uncertainty; search windows keep the tracked size.
+    Size2f spread(int frame) const
+    {
+        return Size2f(0, 0);
+    }
+
+    size_t size() const
+    {
+        return spl_x.size();
+    }
+
+    void reset()
+    {
+        spl_x.clear();
+        spl_y.clear();
+    }
+
+private:
+
+    Spline<int, float> spl_x;
+    Spline<int, float> spl_y;
+};
+
+
+/**
+ * Kalman filter over a constant acceleration (or constant velocity) model.
+ * Update and prediction cost a fixed number of operations on a 6x6 (4x4)
+ * state, independent of the history. Frames may be skipped; the model is
+ * propagated over the actual frame distance.
+ */
+class KalmanPredictor : public CurveFit<KalmanPredictor>
+{
+public:
+
+    KalmanPredictor(bool Accel = true, float ProcessNoise = -1, float MeasurementNoise = 2)
+    :   order(Accel ? 3 : 2),
+        q(ProcessNoise >= 0 ? ProcessNoise : (Accel ? 0.05f : 1.0f)),
+        r(MeasurementNoise),
+        kf(2 * order, 2, 0, CV_32F),
+        measurement(2, 1, CV_32F),
+        last(0),
+        samples(0)
+    {
+        setIdentity(kf.measurementMatrix);
+        setIdentity(kf.measurementNoiseCov, Scalar::all(r * r));
+    }
+
+    // Copies own their filter, the cv::Mat members would share it otherwise.
+    KalmanPredictor(const KalmanPredictor &Other)
+    :   CurveFit<KalmanPredictor>(Other),
+        order(Other.order),
+        q(Other.q),
+        r(Other.r),
+        kf(Other.kf),
+        measurement(Other.measurement.clone()),
+        last(Other.last),
+        samples(Other.samples)
+    {
+        clone_filter();
+    }
+
+    KalmanPredictor &operator=(const KalmanPredictor &Other)
+    {
+        if (this != &Other)
+        {
+            CurveFit<KalmanPredictor>::operator=(Other);
+            order = Other.order;
+            q = Other.q;
+            r = Other.r;
+            kf = Other.kf;
+            measurement = Other.measurement.clone();
+            last = Other.last;
+            samples = Other.samples;
+            clone_filter();
+        }
+        return *this;
+    }
+
+    void update(int frame, const Point2f &pos)
+    {
+        measurement.at<float>(0) = pos.x;
+        measurement.at<float>(1) = pos.y;
+
+        if (samples == 0)
+        {
+            kf.statePost = Scalar::all(0);
+            kf.statePost.at<float>(0) = pos.x;
+            kf.statePost.at<float>(1) = pos.y;
+
+            // position from the measurement, loose prior on the derivatives
+            const float sigma[] = { r, 10, 1 };
+            kf.errorCovPost = Scalar::all(0);
+            for (int i = 0; i < 2 * order; ++i)
+                kf.errorCovPost.at<float>(i, i) = sigma[i / 2] * sigma[i / 2];
+        }
+        else
+        {
+            set_transition(frame - last);
+            kf.predict();
+            kf.correct(measurement);
+        }
+
+        last = frame;
+        ++samples;
+    }
+
+    Point2f predict(int frame) const
+    {
+        float f[3];
+        propagation(frame - last, f);
+
+        Point2f p;
+        for (int i = 0; i < order; ++i)
+        {
+            p.x += f[i] * kf.statePost.at<float>(2 * i);
+            p.y += f[i] * kf.statePost.at<float>(2 * i + 1);
+        }
+        return p;
+    }
+
+    void interpolate(int frame, int count, float *xs, float *ys) const
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            Point2f p = predict(frame + i);
+            xs[i] = p.x;
+            ys[i] = p.y;
+        }
+    }
+
+    Size2f spread(int frame) const
+    {
+        int     dt = frame - last;
+        float   f[3];
+        float   var[2];
+
+        propagation(dt, f);
+
+        // position rows of F P F' + Q
+        for (int a = 0; a < 2; ++a)
+        {
+            var[a] = noise(dt, 0, 0);
+            for (int i = 0; i < order; ++i)
+                for (int j = 0; j < order; ++j)
+                    var[a] += f[i] * f[j] * kf.errorCovPost.at<float>(2 * i + a, 2 * j + a);
+        }
+
+        return Size2f(std::sqrt(std::max(var[0], 0.f)), std::sqrt(std::max(var[1], 0.f)));
+    }
+
+    size_t size() const
+    {
+        return samples;
+    }
+
+    void reset()
+    {
+        samples = 0;
+    }
+
+private:
+
+    int             order;          // 2: position and velocity, 3: plus acceleration
+    float           q;              // white noise intensity of the highest derivative
+    float           r;              // measurement noise (pixels)
+    KalmanFilter    kf;             // state [x y vx vy ax ay]
+    Mat             measurement;
+    int             last;           // frame of the last update
+    size_t          samples;
+
+    void clone_filter()
+    {
+        Mat *m[] = { &kf.statePre, &kf.statePost, &kf.transitionMatrix, &kf.controlMatrix,
+                     &kf.measurementMatrix, &kf.processNoiseCov, &kf.measurementNoiseCov,
+                     &kf.errorCovPre, &kf.gain, &kf.errorCovPost,
+                     &kf.temp1, &kf.temp2, &kf.temp3, &kf.temp4, &kf.temp5 };
+
+        for (size_t i = 0; i < sizeof(m) / sizeof(m[0]); ++i)
+            *m[i] = m[i]->clone();
+    }
+
+    // First row of the transition matrix for one axis over dt frames.
+    void propagation(int dt, float f[3]) const
+    {
+        f[0] = 1;
+        f[1] = dt;
+        f[2] = 0.5f * dt * dt;
+    }
+
+    // Process noise covariance between derivatives i and j of one axis,
+    // integrated over dt frames of continuous white noise on the highest one.
+    float noise(int dt, int i, int j) const
+    {
+        static const float ca[3][3] = { { 1/20.f, 1/8.f, 1/6.f },
+                                        { 1/8.f,  1/3.f, 1/2.f },
+                                        { 1/6.f,  1/2.f, 1.f   } };
+        static const float cv[2][2] = { { 1/3.f, 1/2.f },
+                                        { 1/2.f, 1.f   } };
+        int     p = 2 * order - 1 - i - j;
+
+        return q * std::pow(float(dt), p) * (order == 3 ? ca[i][j] : cv[i][j]);
+    }
+
+    void set_transition(int dt)
+    {
+        float f[3];
+
+        propagation(dt, f);
+        kf.transitionMatrix = Scalar::all(0);
+        kf.processNoiseCov = Scalar::all(0);
+        for (int i = 0; i < order; ++i)
+        {
+            for (int j = i; j < order; ++j)
+            {
+                for (int a = 0; a < 2; ++a)
+                {
+                    kf.transitionMatrix.at<float>(2 * i + a, 2 * j + a) = f[j - i];
+                    kf.processNoiseCov.at<float>(2 * i + a, 2 * j + a) = noise(dt, i, j);
+                    kf.processNoiseCov.at<float>(2 * j + a, 2 * i + a) = noise(dt, i, j);
+                }
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef __RING_HPP__
+#define __RING_HPP__
+
+#include <vector>
+
+using std::vector;
+
+/**
+ * FIFO over a contiguous buffer. Bounded rings never reallocate and expect
+ * the owner to pop_front() before pushing into a full ring; unbounded rings
+ * (capacity 0) grow on demand.
+ */
+template<typename T>
+class Ring
+{
+public:
+
+    Ring(size_t cap = 0)
+        :   buf(cap ? cap : 16),
+            head(0),
+            count(0),
+            bounded(cap > 0)
+    {
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    bool full() const {
+        return bounded && count == buf.size();
+    }
+
+    T& operator[](size_t i) {
+        return buf[(head + i) % buf.size()];
+    }
+
+    const T& operator[](size_t i) const {
+        return buf[(head + i) % buf.size()];
+    }
+
+    void push_back(const T& v) {
+        if (count == buf.size())
+            grow();
+        buf[(head + count) % buf.size()] = v;
+        ++count;
+    }
+
+    void pop_front() {
+        head = (head + 1) % buf.size();
+        --count;
+    }
+
+    void clear() {
+        head = 0;
+        count = 0;
+    }
+private:
+    vector<T> buf;
+    size_t head;
+    size_t count;
+    bool bounded;
+
+    void grow() {
+        vector<T> b(buf.size() * 2);
+        for (size_t i = 0; i < count; ++i)
+            b[i] = (*this)[i];
+        buf.swap(b);
+        head = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef __SPSC_QUEUE_HPP__
+#define __SPSC_QUEUE_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/**
+ * Bounded lock-free queue for exactly one producer and one consumer thread.
+ *
+ * try_push()/try_pop() never wait. push()/pop() spin, then back off to short
+ * sleeps, until they succeed or Stop is raised. Each wait counts as one
+ * stall on its side, and pop() samples the depth, so a slow stage shows up
+ * as stalls of its neighbours and a full queue in front of it.
+ */
+template<typename T>
+class SPSCQueue
+{
+public:
+
+    SPSCQueue(size_t Capacity)
+    :   buf(Capacity + 1),
+        head(0),
+        tail(0),
+        push_waits(0),
+        pop_waits(0),
+        depth_sum(0),
+        pops(0)
+    {
+    }
+
+    bool try_push(const T &Value)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t n = next(t);
+
+        if (n == head.load(std::memory_order_acquire))
+            return false;
+
+        buf[t] = Value;
+        tail.store(n, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T &Value)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+
+        Value = buf[h];
+        head.store(next(h), std::memory_order_release);
+        return true;
+    }
+
+    bool push(const T &Value, const std::atomic<bool> &Stop)
+    {
+        if (try_push(Value))
+            return true;
+
+        push_waits.fetch_add(1, std::memory_order_relaxed);
+        for (int spin = 0; !Stop.load(std::memory_order_relaxed); ++spin)
+        {
+            if (try_push(Value))
+                return true;
+            backoff(spin);
+        }
+        return false;
+    }
+
+    bool pop(T &Value, const std::atomic<bool> &Stop)
+    {
+        depth_sum.fetch_add(size(), std::memory_order_relaxed);
+        pops.fetch_add(1, std::memory_order_relaxed);
+
+        if (try_pop(Value))
+            return true;
+
+        pop_waits.fetch_add(1, std::memory_order_relaxed);
+        for (int spin = 0; !Stop.load(std::memory_order_relaxed); ++spin)
+        {
+            if (try_pop(Value))
+                return true;
+            backoff(spin);
+        }
+        return false;
+    }
+
+    size_t capacity() const
+    {
+        return buf.size() - 1;
+    }
+
+    // Elements queued, exact only when called from the producer or consumer.
+    size_t size() const
+    {
+        size_t h = head.load(std::memory_order_acquire);
+        size_t t = tail.load(std::memory_order_acquire);
+        return t >= h ? t - h : t + buf.size() - h;
+    }
+
+    // Times the producer found the queue full.
+    size_t push_stalls() const
+    {
+        return push_waits.load(std::memory_order_relaxed);
+    }
+
+    // Times the consumer found the queue empty.
+    size_t pop_stalls() const
+    {
+        return pop_waits.load(std::memory_order_relaxed);
+    }
+
+    // Mean depth seen by the consumer.
+    double mean_depth() const
+    {
+        size_t n = pops.load(std::memory_order_relaxed);
+        return n ? depth_sum.load(std::memory_order_relaxed) / (double)n : 0;
+    }
+
+private:
+
+    std::vector<T>      buf;
+    // producer and consumer indices on separate cache lines
+    alignas(64) std::atomic<size_t>     head;
+    alignas(64) std::atomic<size_t>     tail;
+    alignas(64) std::atomic<size_t>     push_waits;
+    std::atomic<size_t> pop_waits;
+    std::atomic<size_t> depth_sum;
+    std::atomic<size_t> pops;
+
+    size_t next(size_t i) const
+    {
+        return i + 1 == buf.size() ? 0 : i + 1;
+    }
+
+    static void backoff(int Spin)
+    {
+        if (Spin < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+};
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef __SPLINE_HPP__
+#define __SPLINE_HPP__
+
+#include <algorithm>
+#include <vector>
+
+#include "Ring.hpp"
+
+/**
+ * Cubic Hermite spline through the latest knots, with tangents from
+ * three-point differences (exact for parabolas). Appending a knot only
+ * touches the tangents of the last two knots, so push_back is O(1).
+ *
+ * Beyond the knots the spline continues along the end tangents; such
+ * extrapolated queries are O(1), queries between knots search the segment
+ * in O(log n).
+ */
+template<typename X, typename Y>
+class Spline
+{
+public:
+
+    Spline(size_t cap = 0)
+        :   knots(cap)
+    {
+    }
+
+    Spline(const std::vector<X>& xs, const std::vector<Y>& ys, size_t cap = 0)
+        :   knots(cap)
+    {
+        for (size_t i = 0; i < xs.size() && i < ys.size(); ++i)
+            push_back(xs[i], ys[i]);
+    }
+
+    size_t size() const {
+        return knots.size();
+    }
+
+    void push_back(X x, Y y) {
+        if (knots.full())
+            knots.pop_front();
+
+        Knot k = { double(x), double(y), 0 };
+        knots.push_back(k);
+
+        size_t n = knots.size();
+        if (n < 2)
+            return;
+        knots[n-1].m = end_tangent(n-1);
+        if (n >= 3) {
+            knots[n-2].m = inner_tangent(n-2);
+            knots[0].m = start_tangent(); // the oldest knot may have been evicted
+        } else {
+            knots[0].m = knots[1].m;
+        }
+    }
+
+    void clear() {
+        knots.clear();
+    }
+
+    const Y interpolate(const X& xq) const {
+        size_t n = knots.size();
+        if (n == 0)
+            return Y(0);
+
+        double x = double(xq);
+        const Knot& last = knots[n-1];
+        if (n == 1)
+            return Y(last.y);
+        if (x >= last.x)
+            return Y(last.y + last.m * (x - last.x));
+        const Knot& head = knots[0];
+        if (x <= head.x)
+            return Y(head.y + head.m * (x - head.x));
+
+        // last knot with knot.x <= x
+        size_t lo = 0, hi = n - 1;
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            if (knots[mid].x <= x)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        return Y(segment(knots[lo], knots[lo+1], x));
+    }
+
+    const Y operator[](const X& x) const {
+        return interpolate(x);
+    }
+
+private:
+
+    struct Knot
+    {
+        double x;
+        double y;
+        double m; // tangent dy/dx
+    };
+
+    Ring<Knot> knots;
+
+    double slope(size_t i) const {
+        return (knots[i+1].y - knots[i].y) / (knots[i+1].x - knots[i].x);
+    }
+
+    double inner_tangent(size_t i) const {
+        double h0 = knots[i].x - knots[i-1].x;
+        double h1 = knots[i+1].x - knots[i].x;
+        return (slope(i-1) * h1 + slope(i) * h0) / (h0 + h1);
+    }
+
+    double end_tangent(size_t i) const {
+        if (i < 2)
+            return slope(i-1);
+        double h0 = knots[i-1].x - knots[i-2].x;
+        double h1 = knots[i].x - knots[i-1].x;
+        return slope(i-1) + (slope(i-1) - slope(i-2)) * h1 / (h0 + h1);
+    }
+
+    double start_tangent() const {
+        double h0 = knots[1].x - knots[0].x;
+        double h1 = knots[2].x - knots[1].x;
+        return slope(0) - (slope(1) - slope(0)) * h0 / (h0 + h1);
+    }
+
+    static double segment(const Knot& a, const Knot& b, double x) {
+        double h = b.x - a.x;
+        double s = (x - a.x) / h;
+        double s2 = s * s;
+        double s3 = s2 * s;
+        return (2*s3 - 3*s2 + 1) * a.y + (s3 - 2*s2 + s) * h * a.m
+             + (-2*s3 + 3*s2) * b.y + (s3 - s2) * h * b.m;
+    }
+};
+
+#endif
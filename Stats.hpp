@@ -20,6 +20,48 @@ public:
         error = vector<vector<float> >(PREDCOUNT, vector<float>());
         mean = vector<float>(PREDCOUNT, 0);
         dev = vector<float>(PREDCOUNT, 0);
+        recent = vector<float>(PREDCOUNT, 0);
+        recent_count = vector<int>(PREDCOUNT, 0);
+    }
+
+    /**
+     * Remembers the positions predicted for the PREDCOUNT frames after
+     * frame, ahead[0] being the next one.
+     */
+    void add_forecast(int frame, const vector<Point2f>& ahead) {
+        assert(ahead.size() == PREDCOUNT);
+        if (forecasts.size() >= PREDCOUNT)
+            forecasts.pop_front();
+        forecasts.push_back(make_pair(frame, ahead));
+    }
+
+    /**
+     * Scores the forecasts that covered frame against the position tracked
+     * there. Frames may be skipped, only those measured are scored.
+     */
+    void add_position(int frame, const Point2f& pos) {
+        for (size_t i = 0; i < forecasts.size(); ++i) {
+            int h = frame - forecasts[i].first;
+            if (h < 1 || h > PREDCOUNT)
+                continue;
+            Point2f d = forecasts[i].second[h - 1] - pos;
+            float e = sqrt(d.x * d.x + d.y * d.y);
+            recent[h - 1] = recent_count[h - 1] ? recent[h - 1] + RECENT_DECAY * (e - recent[h - 1]) : e;
+            ++recent_count[h - 1];
+        }
+        while (!forecasts.empty() && frame - forecasts.front().first >= PREDCOUNT)
+            forecasts.pop_front();
+    }
+
+    // Decaying mean distance in pixels between the positions predicted
+    // horizon frames ahead and those tracked.
+    float recent_error(int horizon) const {
+        return recent[horizon - 1];
+    }
+
+    // Number of predictions recent_error(horizon) is based on.
+    int recent_samples(int horizon) const {
+        return recent_count[horizon - 1];
     }
 
     void print_stats(const deque<pair<int, Point2f> >& points, bool print_header = true) {
@@ -73,6 +115,11 @@ public:
     }
 
 private:
+    static constexpr float RECENT_DECAY = 0.2f;
+
+    deque<pair<int, vector<Point2f> > > forecasts;
+    vector<float> recent;
+    vector<int> recent_count;
     deque<vector<float> > pred;
     vector<vector<float> > error;
     vector<float> mean;
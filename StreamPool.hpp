@@ -0,0 +1,231 @@
+#ifndef __STREAM_POOL_HPP__
+#define __STREAM_POOL_HPP__
+
+#include <algorithm> // std::max
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+#include "VideoProcessor.hpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Tracks several video streams on one pool of worker threads.
+ *
+ * A worker takes the stream that has waited longest, processes one frame
+ * of it with VideoProcessor::Step and queues the stream again, so streams
+ * share the workers frame by frame and a stream is never processed by two
+ * workers at once. Workers can be pinned to cores. Aggregate throughput
+ * and per-stream frame latency, from queueing the stream to the end of
+ * its Step, are kept for report(). A stream that throws or tracks nothing
+ * ends on its own and is reported as failed.
+ */
+class StreamPool
+{
+public:
+
+    // Workers = 0 uses one per hardware thread.
+    StreamPool(size_t Workers = 0, bool Pin = false)
+    :   workers(Workers ? Workers : std::max(thread::hardware_concurrency(), 1u)),
+        pin(Pin),
+        active(0),
+        wall(0)
+    {
+    }
+
+    // Stream is processed headless and must outlive run().
+    void add(VideoProcessor &Stream, const string &Name)
+    {
+        streams.push_back(Entry(&Stream, Name));
+    }
+
+    // Processes all streams until each has ended.
+    void run()
+    {
+        vector<thread>  pool;
+        int64           start = getTickCount();
+
+        runnable.clear();
+        for (size_t i = 0; i < streams.size(); ++i)
+        {
+            streams[i].queued = start;
+            runnable.push_back(i);
+        }
+        active = streams.size();
+
+        for (size_t i = 0; i < std::min(workers, streams.size()); ++i)
+        {
+            pool.push_back(thread(&StreamPool::work, this));
+            if (pin)
+                pin_to_core(pool.back(), i);
+        }
+
+        for (size_t i = 0; i < pool.size(); ++i)
+            pool[i].join();
+
+        wall = (getTickCount() - start) / getTickFrequency();
+    }
+
+    void report(ostream &Out) const
+    {
+        size_t frames = 0;
+
+        Out << "Stream                      frames   step ms latency ms    max ms" << endl;
+        for (size_t i = 0; i < streams.size(); ++i)
+        {
+            const Entry &s = streams[i];
+
+            frames += s.frames;
+            Out << "  " << left << setw(24) << s.name << right << setw(8) << s.frames
+                << fixed << setprecision(2)
+                << setw(10) << (s.frames ? 1e3 * s.busy / s.frames : 0)
+                << setw(10) << (s.frames ? 1e3 * s.latency / s.frames : 0)
+                << setw(10) << 1e3 * s.max_latency;
+            if (!s.error.empty())
+                Out << "  failed: " << s.error;
+            Out << endl;
+        }
+
+        Out << streams.size() << " streams on " << std::min(workers, streams.size())
+            << " workers: " << frames << " frames in " << wall << " s ("
+            << (wall > 0 ? frames / wall : 0) << " fps)" << endl;
+    }
+
+    // Streams that ended with an error.
+    size_t failed() const
+    {
+        size_t n = 0;
+
+        for (size_t i = 0; i < streams.size(); ++i)
+            n += !streams[i].error.empty();
+        return n;
+    }
+
+private:
+
+    struct Entry
+    {
+        Entry(VideoProcessor *Stream, const string &Name)
+        :   proc(Stream),
+            name(Name),
+            frames(0),
+            queued(0),
+            busy(0),
+            latency(0),
+            max_latency(0)
+        {
+        }
+
+        VideoProcessor  *proc;
+        string          name;
+        size_t          frames;
+        int64           queued;         // ticks when last queued for a worker
+        double          busy;           // seconds spent in Step
+        double          latency;        // seconds from queueing to the end of Step
+        double          max_latency;    // longest of those, seconds
+        string          error;          // why the stream failed, if it did
+    };
+
+    vector<Entry>       streams;
+    size_t              workers;
+    bool                pin;
+    mutex               guard;
+    condition_variable  ready;
+    deque<size_t>       runnable;       // streams waiting for a worker
+    size_t              active;         // streams not yet ended
+    double              wall;
+
+    void work()
+    {
+        unique_lock<mutex> lock(guard);
+
+        for (;;)
+        {
+            while (runnable.empty() && active > 0)
+                ready.wait(lock);
+
+            if (runnable.empty())
+                break;
+
+            size_t i = runnable.front();
+            runnable.pop_front();
+
+            lock.unlock();
+            int64   start = getTickCount();
+            bool    more = false;
+            string  error;
+
+            // an exception escaping a worker would end every stream
+            try
+            {
+                more = streams[i].proc->Step();
+            }
+            catch (const cv::Exception &e)
+            {
+                error = e.err;
+            }
+            catch (const std::exception &e)
+            {
+                error = e.what();
+            }
+            if (!error.empty())
+                streams[i].proc->Stop();
+
+            int64   end = getTickCount();
+            lock.lock();
+
+            Entry &s = streams[i];
+            if (more)
+            {
+                double latency = (end - s.queued) / getTickFrequency();
+
+                ++s.frames;
+                s.busy += (end - start) / getTickFrequency();
+                s.latency += latency;
+                s.max_latency = std::max(s.max_latency, latency);
+                s.queued = end;
+                runnable.push_back(i);
+                ready.notify_one();
+            }
+            else
+            {
+                if (!error.empty())
+                    s.error = error;
+                else if (s.frames == 0)
+                    s.error = "nothing tracked";
+
+                if (--active == 0)
+                    ready.notify_all();
+            }
+        }
+    }
+
+    static void pin_to_core(thread &Worker, size_t Index)
+    {
+#ifdef __linux__
+        cpu_set_t   cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(Index % std::max(thread::hardware_concurrency(), 1u), &cpus);
+        if (pthread_setaffinity_np(Worker.native_handle(), sizeof(cpus), &cpus) != 0)
+            cout << "Could not pin worker " << Index << endl;
+#else
+        (void)Worker;
+        (void)Index;
+#endif
+    }
+};
+
+#endif
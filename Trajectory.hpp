@@ -0,0 +1,79 @@
+#ifndef __TRAJECTORY_HPP__
+#define __TRAJECTORY_HPP__
+
+#include "opencv2/core/core.hpp"
+
+#include <cmath>
+#include <ostream>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+// Tracked box of one frame.
+struct TrackRecord
+{
+    TrackRecord(int Frame, const RotatedRect &Box, bool Lost)
+    :   frame(Frame),
+        box(Box),
+        lost(Lost)
+    {
+    }
+
+    int         frame;
+    RotatedRect box;
+    bool        lost;
+};
+
+inline void write_trajectory_header(ostream &Out)
+{
+    Out << "frame,x,y,width,height,angle,lost" << '\n';
+}
+
+inline void write_trajectory(ostream &Out, const TrackRecord &R)
+{
+    Out << R.frame << ',' << R.box.center.x << ',' << R.box.center.y << ','
+        << R.box.size.width << ',' << R.box.size.height << ','
+        << R.box.angle << ',' << R.lost << '\n';
+}
+
+/**
+ * Appends Next, tracked from a later start that overlaps the end of
+ * Trajectory, switching over at the overlapping frame where both agree
+ * best. Returns the distance of the centres there, or -1 when the two have
+ * no frame with a target in common.
+ */
+inline float stitch_trajectory(vector<TrackRecord> &Trajectory, const vector<TrackRecord> &Next)
+{
+    int     last = Trajectory.empty() ? -1 : Trajectory.back().frame;
+    int     cut = last + 1;
+    float   gap = -1;
+    size_t  j = 0;
+
+    for (size_t i = 0; i < Trajectory.size() && j < Next.size(); ++i)
+    {
+        while (j < Next.size() && Next[j].frame < Trajectory[i].frame)
+            ++j;
+        if (j == Next.size() || Next[j].frame != Trajectory[i].frame ||
+            Trajectory[i].lost || Next[j].lost)
+            continue;
+
+        Point2f d = Trajectory[i].box.center - Next[j].box.center;
+        float   dist = std::sqrt(d.x * d.x + d.y * d.y);
+        if (gap < 0 || dist < gap)
+        {
+            gap = dist;
+            cut = Trajectory[i].frame;
+        }
+    }
+
+    while (!Trajectory.empty() && Trajectory.back().frame >= cut)
+        Trajectory.pop_back();
+    for (j = 0; j < Next.size(); ++j)
+        if (Next[j].frame >= cut)
+            Trajectory.push_back(Next[j]);
+
+    return gap;
+}
+
+#endif
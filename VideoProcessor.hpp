@@ -8,11 +8,14 @@
 
 #include <iostream>
 
+#include "FrameGrabber.hpp"
+#include "FramePipeline.hpp"
+
 using namespace cv;
 using namespace std;
 
 
-struct VideoProcessor
+struct VideoProcessor : private FramePipeline::Stages
 {
 
     VideoProcessor(VideoCapture &Frames, string WindowName)
@@ -20,24 +23,46 @@ struct VideoProcessor
         wndname(WindowName),
         rotate(0.0),
         scale(1),
+        rotate_coords(false),
         paused(true),
+        backproj(false),
         quit(false),
         selecting(false),
-        frameCount(0)
+        frameCount(0),
+        grabber(NULL),
+        grab_capacity(0),
+        grab_policy(FrameGrabber::BLOCK),
+        pipeline(NULL),
+        pipeline_depth(0),
+        headless(false),
+        output_fps(0),
+        latency_budget(0),
+        frame_ticks(0),
+        first_ticks(0),
+        clock_fps(30),
+        clock(0),
+        process_secs(0),
+        dropped_last(false),
+        late_frames(0),
+        effort_level(FULL_EFFORT)
     {
-        namedWindow(wndname.c_str(), CV_WINDOW_AUTOSIZE);
-        setMouseCallback(wndname.c_str(), on_mouse, this);
     }
 
     virtual ~VideoProcessor()
     {
+        stop_capture();
     }
 
     // Applies scaling or rotational transformation to input movie.
-    void SetTransform(int Rotate, int Scale)
+    // With RotateCoordinates frames are tracked unrotated and only the
+    // display and the reported coordinates are rotated, see to_view().
+    void SetTransform(int Rotate, int Scale, bool RotateCoordinates = false)
     {
         rotate = Rotate;
         scale = Scale;
+        rotate_coords = RotateCoordinates;
+        warp.release();
+        view_warp.release();
     }
 
     // Sets an initial selection window to select target region.
@@ -47,29 +72,84 @@ struct VideoProcessor
     }
 
 
+    // Decodes frames on a capture thread into a ring of Capacity frames,
+    // see FrameGrabber.hpp. 0 reads frames synchronously.
+    void SetAsyncCapture(size_t Capacity, FrameGrabber::Policy FullPolicy)
+    {
+        grab_capacity = Capacity;
+        grab_policy = FullPolicy;
+    }
+
+    // Decodes, transforms and prepares frames on a pipeline of threads with
+    // queues of Depth frames, see FramePipeline.hpp. 0 turns it off. The
+    // pipeline decodes on its own, it replaces the capture thread.
+    void SetPipeline(size_t Depth)
+    {
+        pipeline_depth = Depth;
+    }
+
+    // Runs without window and key handling as fast as frames can be
+    // processed. Tracking starts from the selection set with SetSelection,
+    // overlays are only drawn when written to SetOutput.
+    void SetHeadless(bool Headless)
+    {
+        headless = Headless;
+    }
+
+    // Writes the processed frames, overlays included, to a video file.
+    void SetOutput(const string &File)
+    {
+        output_file = File;
+    }
+
+    /**
+     * Keeps the time from capture to the end of processing of a live
+     * source under BudgetMs. A frame that could only be finished late is
+     * dropped (never two in a row), and while frames end close to the budget
+     * processors are asked for less effort, see effort(). Predictors then
+     * run on capture time instead of frame numbers, see frame_time().
+     * Needs SetAsyncCapture or SetPipeline: a synchronous read can only
+     * stamp the frame once it is decoded, so it never seems to wait.
+     * 0 turns it off.
+     */
+    void SetLatencyBudget(double BudgetMs)
+    {
+        latency_budget = std::max(BudgetMs, 0.0) / 1000;
+    }
+
     void Play(bool Paused)
     {
         paused = Paused;
+        quit = !start();
 
-        quit = !next_frame();
-        if (!quit)
+        if (headless)
         {
-            process_frame(image);
+            int64   ticks = getTickCount();
+            int     processed = 0;
+            int     dropped = 0;
 
-            if (selection.height > 0 && selection.width > 0)
+            while (!quit && next_frame())
             {
-                region_selected(selection);    
+                if (process_current())
+                    ++processed;
+                else
+                    ++dropped;
             }
-            
-            imshow( wndname.c_str(), image );    
+
+            double secs = (getTickCount() - ticks) / getTickFrequency();
+            cout << "Processed " << processed << " frames in " << secs << " s ("
+                 << (secs > 0 ? processed / secs : 0) << " fps)";
+            if (dropped > 0)
+                cout << ", dropped " << dropped << " late";
+            cout << endl;
+            quit = true;
         }
 
         while ( !quit )
         {
             if (!paused)
             {
-                process_frame(image);
-                imshow(wndname.c_str(), image);
+                process_current();
                 quit = !next_frame();
             }
 
@@ -95,6 +175,44 @@ struct VideoProcessor
 
         }
 
+        // capture threads call back into derived classes, stop them while
+        // those still exist
+        stop_capture();
+    }
+
+    /**
+     * Processes the next frame headless, for callers that drive processors
+     * themselves. The first call also processes the first frame and starts
+     * tracking the selection. Returns false once the stream has ended, the
+     * capture threads are stopped then.
+     */
+    bool Step()
+    {
+        if (frameCount == 0)
+        {
+            headless = true;
+            if (!start())
+            {
+                stop_capture();
+                return false;
+            }
+        }
+
+        if (!next_frame())
+        {
+            stop_capture();
+            return false;
+        }
+
+        process_current();
+        return true;
+    }
+
+    // Stops the capture threads of a processor driven by Step(), for callers
+    // done with it before the stream has ended.
+    void Stop()
+    {
+        stop_capture();
     }
 
     void pause()
@@ -106,16 +224,16 @@ struct VideoProcessor
     {
         if (selecting)
         {
-            Mat roi(image, selection);
+            Mat roi(display, selection);
             bitwise_not(roi, roi);
             
             selection.width = std::abs(x - selection.x);
             selection.height = std::abs(y - selection.y);
 
-            roi = Mat(image, selection);
+            roi = Mat(display, selection);
             bitwise_not(roi, roi);
 
-            imshow(wndname.c_str(), image);
+            imshow(wndname.c_str(), display);
         }
 
 
@@ -130,22 +248,24 @@ struct VideoProcessor
             }
             else
             {
+                // restore the region before the processor looks at it
+                Mat roi(display, selection);
+
+                bitwise_not(roi, roi);
+
                 if (selection.area() > 16)
                 {
                     cout << "Region selected x=" << selection.x << " y=" << selection.y 
                          << " h=" << selection.height << " w=" << selection.width << endl;
 
-                    region_selected(selection);
+                    region_selected(to_native(selection));
                 }
                 else
                 {
                     cout << "Slection area not big enough to track." << endl;
                 }
 
-                Mat roi(image, selection);
-
-                bitwise_not(roi, roi);
-                imshow(wndname.c_str(), image);                
+                imshow(wndname.c_str(), display);                
             }
 
             selecting = !selecting;
@@ -162,12 +282,114 @@ protected:
     {
     }
 
+    // Starts tracking without a selection, returns false if it cannot.
+    virtual bool acquire_target()
+    {
+        return false;
+    }
+
+    // Work on a frame that does not depend on tracking state, run ahead of
+    // process_frame on the pipeline thread in pipeline mode. Results land in
+    // planes for process_frame, which stays empty otherwise.
+    virtual void prepare_frame(Mat Image, vector<Mat> &Planes)
+    {
+    }
+
+    // Work processors should spend on a frame to stay in the latency budget.
+    enum Effort
+    {
+        FULL_EFFORT,
+        REDUCED_EFFORT,
+        MINIMAL_EFFORT
+    };
+
+    Effort effort() const
+    {
+        return effort_level;
+    }
+
+    // Mean shift steps CamShift should take at the current effort.
+    int camshift_iterations() const
+    {
+        static const int steps[] = { 10, 5, 2 };
+        return steps[effort_level];
+    }
+
+    // Time of the current frame for predictors: the frame number, or with a
+    // latency budget the capture time in frame intervals of the source, so
+    // dropped frames leave gaps instead of compressing the motion.
+    int frame_time() const
+    {
+        return latency_budget > 0 ? clock : frameCount;
+    }
+
     bool backproj_mode()
     {
         return backproj;
     }
 
+    bool headless_mode()
+    {
+        return headless;
+    }
+
+    // Overlays are drawn when somebody looks at them.
+    bool overlay_mode()
+    {
+        return !headless || !output_file.empty();
+    }
+
+    // Current frame as processed.
+    const Mat &frame_image() const
+    {
+        return image;
+    }
+
+    // Box in the frame of reference of the display, which is rotated against
+    // the processed frame in coordinate rotation mode.
+    RotatedRect to_view(const RotatedRect &Box)
+    {
+        if (!view_rotated())
+            return Box;
+
+        update_view();
+
+        const Mat_<double>  &v = view_warp;
+        RotatedRect         r = Box;
+
+        r.center.x = v(0,0) * Box.center.x + v(0,1) * Box.center.y + v(0,2);
+        r.center.y = v(1,0) * Box.center.x + v(1,1) * Box.center.y + v(1,2);
+        r.angle = Box.angle - rotate;
+        return r;
+    }
+
+    // Bounding box in the processed frame of a region of the display.
+    Rect to_native(const Rect &Region)
+    {
+        if (!view_rotated())
+            return Region;
+
+        update_view();
+
+        const Mat_<double>  &u = view_unwarp;
+        vector<Point2f>     corners;
+
+        corners.push_back(Point2f(Region.x, Region.y));
+        corners.push_back(Point2f(Region.x + Region.width, Region.y));
+        corners.push_back(Point2f(Region.x, Region.y + Region.height));
+        corners.push_back(Point2f(Region.x + Region.width, Region.y + Region.height));
+        for (size_t i = 0; i < corners.size(); ++i)
+        {
+            Point2f p = corners[i];
+            corners[i] = Point2f(u(0,0) * p.x + u(0,1) * p.y + u(0,2),
+                                 u(1,0) * p.x + u(1,1) * p.y + u(1,2));
+        }
+
+        return boundingRect(corners) & Rect(0, 0, image.cols, image.rows);
+    }
+
     int             frameCount;
+    vector<Mat>     planes;     // Prepared for the current frame.
 
 private:
 
@@ -176,40 +398,289 @@ private:
     Mat             image;      // Current frame image.
     double          rotate;
     int             scale;
+    Mat             warp;       // Rotation and scale of frames of size warp_from.
+    Size            warp_from;
+    bool            rotate_coords;
+    Size            source_size;    // Frame size before scaling.
+    Mat             view_warp;      // Processed to displayed frame, and back.
+    Mat             view_unwarp;
+    Mat             display;        // Current frame as displayed.
     bool            paused;
     bool            backproj;
     bool            quit;
     bool            selecting;
     Rect            selection;
+    Mat             captured;   // Last decoded frame, recycled by the grabber.
+    FrameGrabber    *grabber;
+    size_t          grab_capacity;
+    FrameGrabber::Policy    grab_policy;
+    FramePipeline   *pipeline;
+    size_t          pipeline_depth;
+    bool            headless;
+    string          output_file;
+    double          output_fps;
+    VideoWriter     writer;
+    double          latency_budget; // seconds, 0 = off
+    int64           frame_ticks;    // getTickCount() when the frame was decoded
+    int64           first_ticks;
+    double          clock_fps;      // frame_time() units per second
+    int             clock;
+    double          process_secs;   // decaying mean processing time
+    bool            dropped_last;
+    size_t          late_frames;
+    Effort          effort_level;
 
     bool next_frame()
     {
         bool    empty;
-        Mat     frame;
 
         frameCount++;
 
-        frames >> frame;
-        empty = frame.empty();
+        if (pipeline)
+        {
+            empty = !pipeline->read(image, planes, &frame_ticks);
+        }
+        else
+        {
+            if (grabber)
+            {
+                empty = !grabber->read(captured, &frame_ticks);
+            }
+            else
+            {
+                empty = !frames.read(captured) || captured.empty();
+                frame_ticks = getTickCount();
+            }
+
+            if (!empty)
+                transform_frame(captured, image);
+        }
+
         if (!empty)
+            update_clock();
+
+        return !empty;
+    }
+
+    // Advances frame_time() to the capture time of the current frame, at
+    // least one step per frame.
+    void update_clock()
+    {
+        if (frameCount == 1)
+            first_ticks = frame_ticks;
+
+        double  secs = (frame_ticks - first_ticks) / getTickFrequency();
+        int     t = 1 + cvRound(secs * clock_fps);
+
+        clock = std::max(t, clock + 1);
+    }
+
+    /**
+     * Processes and shows the current frame. With a latency budget a frame
+     * that would end late is dropped unless the one before was, and the
+     * effort is raised or lowered by how close to the budget frames end.
+     * Returns false when the frame was dropped.
+     */
+    bool process_current()
+    {
+        if (latency_budget <= 0)
         {
-            frame.copyTo(image);
+            process_frame(image);
+            show_frame();
+            return true;
+        }
 
-            if (rotate != 0.0)
-            {
-                Point2f src_center(image.cols/2.0F, image.rows/2.0F);
-                Mat     rot_mat;
+        int64   ticks = getTickCount();
+        double  waited = (ticks - frame_ticks) / getTickFrequency();
+
+        if (waited + process_secs > latency_budget && !dropped_last)
+        {
+            dropped_last = true;
+            ++late_frames;
+            effort_level = MINIMAL_EFFORT;
+            return false;
+        }
+        dropped_last = false;
+
+        process_frame(image);
+        show_frame();
 
-                rot_mat = getRotationMatrix2D(src_center, rotate, 1.0);
-                warpAffine(image, image, rot_mat, image.size());
+        double secs = (getTickCount() - ticks) / getTickFrequency();
+        double latency = waited + secs;
+
+        process_secs = process_secs > 0 ? process_secs + 0.1 * (secs - process_secs) : secs;
+
+        if (latency > 0.8 * latency_budget && effort_level < MINIMAL_EFFORT)
+            effort_level = Effort(effort_level + 1);
+        else if (latency < 0.4 * latency_budget && effort_level > FULL_EFFORT)
+            effort_level = Effort(effort_level - 1);
+        return true;
+    }
+
+    // Sets up display and capture and processes the first frame. Returns
+    // false when there is nothing to play.
+    bool start()
+    {
+        if (!headless)
+        {
+            namedWindow(wndname.c_str(), CV_WINDOW_AUTOSIZE);
+            setMouseCallback(wndname.c_str(), on_mouse, this);
+        }
+
+        // ask before capture threads own the source
+        source_size = Size((int)frames.get(CV_CAP_PROP_FRAME_WIDTH),
+                           (int)frames.get(CV_CAP_PROP_FRAME_HEIGHT));
+
+        if (!output_file.empty() || latency_budget > 0)
+        {
+            output_fps = frames.get(CV_CAP_PROP_FPS);
+            if (output_fps <= 0)
+                output_fps = 30;
+            clock_fps = output_fps;
+        }
+
+        if (pipeline_depth > 0 && !pipeline)
+            pipeline = new FramePipeline(frames, *this, pipeline_depth);
+        else if (grab_capacity > 0 && !grabber)
+            grabber = new FrameGrabber(frames, grab_capacity, grab_policy);
+
+        if (!next_frame())
+            return false;
+
+        process_frame(image);
+
+        if (selection.height > 0 && selection.width > 0)
+        {
+            // selections from the command line may reach out of the frame
+            Rect r = to_native(selection) & Rect(0, 0, image.cols, image.rows);
+
+            if (r.area() == 0)
+            {
+                cout << "The selection lies outside the frame." << endl;
+                return false;
             }
+            region_selected(r);
+        }
+        else if (headless && !acquire_target())
+        {
+            cout << "Headless mode needs an initial selection or a target to find." << endl;
+            return false;
+        }
+        
+        show_frame();
+        return true;
+    }
+
+    void show_frame()
+    {
+        if (headless && output_file.empty())
+            return;
 
-            resize(image, image, Size(image.cols/scale, image.rows/scale));
+        // the only rotation of pixels left in coordinate rotation mode
+        if (view_rotated())
+        {
+            update_view();
+            warpAffine(image, display, view_warp, image.size());
+        }
+        else
+        {
+            // a copy, the pipeline recycles image while the mouse callback
+            // still draws on display
+            image.copyTo(display);
         }
 
-        return !empty;
+        if (!headless)
+            imshow(wndname.c_str(), display);
+
+        if (!output_file.empty())
+        {
+            if (!writer.isOpened())
+                writer.open(output_file, CV_FOURCC('M','J','P','G'), output_fps, display.size());
+            writer << display;
+        }
+    }
+
+    bool view_rotated() const
+    {
+        return rotate_coords && rotate != 0.0;
+    }
+
+    // The rotation transform_frame would apply, expressed in the scaled
+    // frame: S R S^-1 with R the rotation about the centre of the source.
+    void update_view()
+    {
+        if (!view_warp.empty())
+            return;
+
+        Size    full = source_size.area() > 0 ? source_size : Size(image.cols * scale, image.rows * scale);
+        double  sx = (double)(full.width / scale) / full.width;
+        double  sy = (double)(full.height / scale) / full.height;
+        Mat_<double> r = getRotationMatrix2D(Point2f(full.width/2.0F, full.height/2.0F), rotate, 1.0);
+
+        view_warp = (Mat_<double>(2, 3) << r(0,0), r(0,1) * sx / sy, r(0,2) * sx,
+                                           r(1,0) * sy / sx, r(1,1), r(1,2) * sy);
+        invertAffineTransform(view_warp, view_unwarp);
+    }
+
+    void stop_capture()
+    {
+        if (grabber)
+        {
+            if (grabber->dropped() > 0)
+                cout << "Capture dropped " << grabber->dropped() << " frames" << endl;
+            delete grabber;
+            grabber = NULL;
+        }
+
+        if (pipeline)
+        {
+            pipeline->report(cout);
+            delete pipeline;
+            pipeline = NULL;
+        }
+
+        if (late_frames > 0)
+        {
+            cout << "Latency budget dropped " << late_frames << " late frames" << endl;
+            late_frames = 0;
+        }
     }
 
+    /**
+     * Rotates and downscales Frame into Image in one pass at the output
+     * resolution, reusing Image's buffer. Without a transformation the
+     * buffers are swapped instead of copied, Frame then holds the old image
+     * for the next decode.
+     */
+    void transform_frame(Mat &Frame, Mat &Image)
+    {
+        Size    out(Frame.cols/scale, Frame.rows/scale);
+        bool    rotated = rotate != 0.0 && !rotate_coords;
+
+        if (!rotated && out == Frame.size())
+        {
+            std::swap(Frame, Image);
+        }
+        else if (!rotated)
+        {
+            resize(Frame, Image, out);
+        }
+        else
+        {
+            if (warp.empty() || warp_from != Frame.size())
+            {
+                Point2f src_center(Frame.cols/2.0F, Frame.rows/2.0F);
+
+                // rotation about the centre, then scaling to the output size
+                warp = getRotationMatrix2D(src_center, rotate, 1.0);
+                warp.row(0) *= (double)out.width / Frame.cols;
+                warp.row(1) *= (double)out.height / Frame.rows;
+                warp_from = Frame.size();
+            }
+
+            warpAffine(Frame, Image, warp, out);
+        }
+    }
 
     static void on_mouse(int event, int x, int y, int, void *arg)
     {
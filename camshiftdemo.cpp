@@ -14,6 +14,7 @@
 
 using namespace cv;
 using namespace std;
+using LS::LSFit;
 
 Mat image;
 
@@ -133,6 +134,10 @@ int main(int argc, const char** argv)
 
     Mat frame, hsv, hue, mask, hist, histimg = Mat::zeros(200, 320, CV_8UC3), backproj;
     deque<pair<int, Point2f> > points;
+    // predictors over the last PREDCOUNT points, updated once per frame
+    Spline<int, float> spl_x(Stats::PREDCOUNT), spl_y(Stats::PREDCOUNT);
+    LSFit<3, int, float> cls_x(false, true, Stats::PREDCOUNT), cls_y(false, true, Stats::PREDCOUNT);
+    LSFit<3, int, float> clsw_x(true, true, Stats::PREDCOUNT), clsw_y(true, true, Stats::PREDCOUNT);
     bool paused = !startPlayback;
     cap >> frame;
     if (!frame.empty())
@@ -159,6 +164,14 @@ int main(int argc, const char** argv)
                 mixChannels(&hsv, 1, &hue, 1, ch, 1);
 
                 if (trackObject < 0) {
+                    points.clear();
+                    spl_x.clear();
+                    spl_y.clear();
+                    cls_x.clear();
+                    cls_y.clear();
+                    clsw_x.clear();
+                    clsw_y.clear();
+
                     Mat roi(hue, selection), maskroi(mask, selection);
                     calcHist(&roi, 1, 0, maskroi, hist, 1, &hsize, &phranges);
                     normalize(hist, hist, 0, 255, CV_MINMAX);
@@ -192,6 +205,12 @@ int main(int argc, const char** argv)
                 points.push_back(make_pair(frameCount, center));
                 if (points.size() > Stats::PREDCOUNT)
                     points.pop_front();
+                spl_x.push_back(frameCount, center.x);
+                spl_y.push_back(frameCount, center.y);
+                cls_x.push_back(frameCount, center.x);
+                cls_y.push_back(frameCount, center.y);
+                clsw_x.push_back(frameCount, center.x);
+                clsw_y.push_back(frameCount, center.y);
                 int alpha = 255;
                 for (deque<pair<int, Point2f> >::const_reverse_iterator it = points.rbegin(); it != points.rend(); ++it) {
                     circle(image, it->second, 4, Scalar(255,0,0,alpha), 2);
@@ -201,20 +220,6 @@ int main(int argc, const char** argv)
                 stats_cls.print_stats(points, false); // does nothing with < 10 points
                 // predict next occurance
                 if (points.size() >= 5) {
-                    vector<int> frames;
-                    vector<float> points_x;
-                    vector<float> points_y;
-                    for (deque<pair<int, Point2f> >::const_iterator it = points.begin(); it != points.end(); ++it) {
-                        frames.push_back(it->first);
-                        points_x.push_back(it->second.x);
-                        points_y.push_back(it->second.y);
-                    }
-                    Spline<int, float> spl_x(frames, points_x);
-                    Spline<int, float> spl_y(frames, points_y);
-                    LSFit<3, int, float> cls_x(frames, points_x);
-                    LSFit<3, int, float> cls_y(frames, points_y);
-                    LSFit<3, int, float> clsw_x(frames, points_x, true);
-                    LSFit<3, int, float> clsw_y(frames, points_y, true);
                     vector<float> curpred; // stats
                     vector<float> curpred_cls; // stats
                     // draw next predicted ten points
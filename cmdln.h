@@ -307,7 +307,11 @@ namespace cmdln
                 opt_val_t<Ty>   vopt;
                 char            **argv;
 
-                std::cout << "here" << std::endl;
+                // vopt is unnamed, skip our own option name
+                if ( named() )
+                    {
+                    ArgVal++;
+                    }
                 
                 argv = vopt.parse(ArgVal);
                 opt_list.push_back(vopt);
@@ -324,12 +328,12 @@ namespace cmdln
                 
             const Ty& operator[] (int Index)
             {
-                return opt_list[Index];
+                return opt_list[Index].value();
             }
                 
             const Ty& value(int Index)
                 {
-                return opt_list[Index];
+                return opt_list[Index].value();
                 }
                 
         private:
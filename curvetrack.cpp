@@ -1,7 +1,19 @@
+#include <cstdio> // sscanf
+#include <cstdlib> // atoi
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include <string>
 
 #include "cmdln.h"
 #include "CurveFitProcessor.hpp"
+#include "Ensemble.hpp"
+#include "JobScheduler.hpp"
+#include "Manifest.hpp"
+#include "MultiTargetProcessor.hpp"
+#include "StreamPool.hpp"
+#include "Trajectory.hpp"
 
 using namespace cv;
 using namespace std;
@@ -28,11 +40,500 @@ static void help()
 }
 
 
+// Processing options shared by every stream.
+struct Settings
+{
+    string  model;
+    int     rotate;
+    bool    rotate_coords;
+    int     scale;
+    int     vmin;
+    int     vmax;
+    int     smin;
+    int     lut;
+    bool    roi;
+    bool    tiled;
+    bool    pyramid;
+    int     skip;
+    double  latency;
+    float   skip_error;
+    int     queue;
+    bool    drop;
+    int     pipeline;
+};
+
+
+template<class Predictor>
+static CamShiftProcessor *make_curve_fit(VideoCapture &Cap, const string &Name, const Settings &S,
+                                         const Predictor &Pred = Predictor())
+{
+    CurveFitProcessor<Predictor> *curve_fit = new CurveFitProcessor<Predictor>(Cap, Name, Pred);
+
+    curve_fit->SetFrameSkipping(S.skip, S.skip_error);
+    return curve_fit;
+}
+
+
+static CamShiftProcessor *make_processor(VideoCapture &Cap, const string &Name, const Settings &S)
+{
+    CamShiftProcessor     *camshift;
+
+    if (S.model == "kalman")
+        camshift = make_curve_fit(Cap, Name, S, KalmanPredictor(true));
+    else if (S.model == "kalman-cv")
+        camshift = make_curve_fit(Cap, Name, S, KalmanPredictor(false));
+    else if (S.model == "spline")
+        camshift = make_curve_fit<SplinePredictor>(Cap, Name, S);
+    else if (S.model == "ensemble")
+        camshift = make_curve_fit<PredictorEnsemble>(Cap, Name, S);
+    else
+        camshift = make_curve_fit<CurvePredictor<> >(Cap, Name, S);
+
+    camshift->SetTransform(S.rotate, S.scale, S.rotate_coords);
+    camshift->SetThresholds(S.vmin, S.vmax, S.smin);
+    camshift->SetLookup(S.lut);
+    camshift->SetRegionOfInterest(S.roi);
+    camshift->SetTiledBackprojection(S.tiled);
+    camshift->SetPyramid(S.pyramid);
+    camshift->SetAsyncCapture(std::max(S.queue, 0),
+                              S.drop ? FrameGrabber::DROP_OLDEST : FrameGrabber::BLOCK);
+    camshift->SetPipeline(std::max(S.pipeline, 0));
+    camshift->SetLatencyBudget(S.latency);
+
+    return camshift;
+}
+
+
+static MultiTargetProcessor *make_multi_processor(VideoCapture &Cap, const string &Name, const Settings &S)
+{
+    MultiTargetProcessor    *multi;
+
+    if (S.model == "kalman")
+        multi = new MultiCurveFitProcessor<KalmanPredictor>(Cap, Name, KalmanPredictor(true));
+    else if (S.model == "kalman-cv")
+        multi = new MultiCurveFitProcessor<KalmanPredictor>(Cap, Name, KalmanPredictor(false));
+    else if (S.model == "spline")
+        multi = new MultiCurveFitProcessor<SplinePredictor>(Cap, Name);
+    else if (S.model == "ensemble")
+        multi = new MultiCurveFitProcessor<PredictorEnsemble>(Cap, Name);
+    else
+        multi = new MultiCurveFitProcessor<CurvePredictor<> >(Cap, Name);
+
+    multi->SetTransform(S.rotate, S.scale, S.rotate_coords);
+    multi->SetThresholds(S.vmin, S.vmax, S.smin);
+    multi->SetPyramid(S.pyramid);
+    multi->SetAsyncCapture(std::max(S.queue, 0),
+                           S.drop ? FrameGrabber::DROP_OLDEST : FrameGrabber::BLOCK);
+    multi->SetPipeline(std::max(S.pipeline, 0));
+    multi->SetLatencyBudget(S.latency);
+
+    return multi;
+}
+
+
+// Parses x,y,w,h into a non-empty Rect.
+static bool parse_rect(const char *Spec, Rect &R)
+{
+    char tail;
+
+    return sscanf(Spec, "%d,%d,%d,%d%c", &R.x, &R.y, &R.width, &R.height, &tail) == 4 &&
+           R.width > 0 && R.height > 0;
+}
+
+
+// Opens a stream given as source@x,y,w,h, the source being a file name or
+// a camera number.
+static bool open_stream(const string &Spec, VideoCapture &Cap, string &Source, Rect &Selection)
+{
+    size_t  at = Spec.rfind('@');
+
+    if (at == string::npos || !parse_rect(Spec.c_str() + at + 1, Selection))
+    {
+        cout << "Stream \"" << Spec << "\" is not source@x,y,w,h" << endl;
+        return false;
+    }
+
+    Source = Spec.substr(0, at);
+    if (!Source.empty() && Source.find_first_not_of("0123456789") == string::npos)
+        Cap.open(atoi(Source.c_str()));
+    else
+        Cap.open(Source.c_str());
+
+    if (!Cap.isOpened())
+    {
+        cout << "***Could not open " << Source << "***" << endl;
+        return false;
+    }
+    return true;
+}
+
+
+// Tracks every stream headless on a shared worker pool.
+static int track_streams(cmdln::opt_list_t<string> &Streams, const Settings &S,
+                         int Workers, bool Pin, const string &Track)
+{
+    StreamPool                  pool(std::max(Workers, 0), Pin);
+    vector<VideoCapture *>      caps;
+    vector<CamShiftProcessor *> procs;
+    int                         status = 0;
+
+    for (int i = 0; i < Streams.size(); ++i)
+    {
+        VideoCapture    *cap = new VideoCapture;
+        string          source;
+        Rect            selection;
+
+        caps.push_back(cap);
+        if (!open_stream(Streams[i], *cap, source, selection))
+        {
+            status = -1;
+            continue;
+        }
+
+        CamShiftProcessor *camshift = make_processor(*cap, source, S);
+        camshift->SetHeadless(true);
+        camshift->SetSelection(selection);
+        if (!Track.empty())
+        {
+            stringstream file;
+            file << Track << "." << i;
+            camshift->SetTrajectoryOutput(file.str());
+        }
+
+        procs.push_back(camshift);
+        pool.add(*camshift, source);
+    }
+
+    pool.run();
+    pool.report(cout);
+    if (pool.failed() > 0)
+        status = -1;
+
+    for (size_t i = 0; i < procs.size(); ++i)
+        delete procs[i];
+    for (size_t i = 0; i < caps.size(); ++i)
+        delete caps[i];
+
+    return status;
+}
+
+
+// Status of a job that failed with Message, one CSV field.
+static string error_status(const string &Message)
+{
+    string status = "error:" + Message;
+
+    for (size_t i = 0; i < status.size(); ++i)
+    {
+        if (status[i] == ',' || status[i] == '\n' || status[i] == '\r')
+            status[i] = ' ';
+    }
+    return status;
+}
+
+
+// Per-job lines of a batch run, written as jobs finish.
+class BatchSummary
+{
+public:
+
+    BatchSummary(const string &File, size_t Jobs)
+    :   out(File.c_str()),
+        total(Jobs),
+        finished(0)
+    {
+        out << "clip,output,status,frames,seconds,fps,worker" << endl;
+    }
+
+    bool is_open() const
+    {
+        return out.is_open();
+    }
+
+    void done(const ClipSpec &Clip, const string &Status, int Frames, double Secs, size_t Worker)
+    {
+        lock_guard<mutex> lock(guard);
+
+        ++finished;
+        out << Clip.clip << ',' << Clip.output << ',' << Status << ',' << Frames << ','
+            << Secs << ',' << (Secs > 0 ? Frames / Secs : 0) << ',' << Worker << endl;
+        cout << "[" << finished << "/" << total << "] " << Clip.clip << ": " << Status
+             << ", " << Frames << " frames in " << Secs << " s" << endl;
+    }
+
+private:
+
+    mutex       guard;
+    ofstream    out;
+    size_t      total;
+    size_t      finished;
+};
+
+
+// Tracks one manifest clip headless.
+struct ClipJob : public JobScheduler::Job
+{
+    ClipJob(const ClipSpec &Clip, const Settings &S, BatchSummary &Summary)
+    :   clip(Clip),
+        settings(S),
+        summary(Summary)
+    {
+        settings.vmin = Clip.vmin;
+        settings.vmax = Clip.vmax;
+        settings.smin = Clip.smin;
+    }
+
+    virtual void run(size_t Worker)
+    {
+        int64           start = getTickCount();
+        VideoCapture    cap(clip.clip.c_str());
+        int             frames = 0;
+        string          status = "ok";
+
+        if (!cap.isOpened())
+        {
+            status = "unreadable";
+        }
+        else
+        {
+            CamShiftProcessor *camshift = make_processor(cap, clip.clip, settings);
+
+            camshift->SetHeadless(true);
+            camshift->SetSelection(clip.selection);
+            camshift->SetTrajectoryOutput(clip.output);
+
+            // one bad clip must not take the batch down with it
+            try
+            {
+                while (camshift->Step())
+                    ++frames;
+                if (frames == 0)
+                    status = error_status("nothing tracked");
+            }
+            catch (const cv::Exception &e)
+            {
+                status = error_status(e.err);
+            }
+            catch (const std::exception &e)
+            {
+                status = error_status(e.what());
+            }
+            delete camshift;
+        }
+
+        summary.done(clip, status, frames, (getTickCount() - start) / getTickFrequency(), Worker);
+    }
+
+    ClipSpec        clip;
+    Settings        settings;
+    BatchSummary    &summary;
+};
+
+
+// Runs every clip of the manifest on all cores.
+static int run_manifest(const string &File, const Settings &S, int Workers, const string &SummaryFile)
+{
+    vector<ClipSpec>    clips;
+    string              error;
+
+    if (!read_manifest(File, clips, error))
+    {
+        cout << error << endl;
+        return -1;
+    }
+
+    BatchSummary        summary(SummaryFile, clips.size());
+    JobScheduler        scheduler(std::max(Workers, 0));
+    vector<ClipJob *>   jobs;
+    int64               start = getTickCount();
+
+    if (!summary.is_open())
+    {
+        cout << "Could not open summary file " << SummaryFile << endl;
+        return -1;
+    }
+
+    for (size_t i = 0; i < clips.size(); ++i)
+    {
+        jobs.push_back(new ClipJob(clips[i], S, summary));
+        scheduler.submit(jobs.back());
+    }
+
+    scheduler.run();
+
+    cout << clips.size() << " clips on " << scheduler.workers() << " workers in "
+         << (getTickCount() - start) / getTickFrequency() << " s, "
+         << scheduler.steals() << " stolen" << endl;
+
+    for (size_t i = 0; i < jobs.size(); ++i)
+        delete jobs[i];
+
+    return 0;
+}
+
+
+// Tracks frames First..Last of one segment headless.
+struct SegmentJob : public JobScheduler::Job
+{
+    SegmentJob(CamShiftProcessor *Proc, int Last)
+    :   proc(Proc),
+        last(Last),
+        secs(0)
+    {
+        proc->SetTrajectoryRecord(&record);
+    }
+
+    virtual void run(size_t)
+    {
+        int64 start = getTickCount();
+
+        // a failing segment keeps what it tracked, the others go on
+        try
+        {
+            while ((record.empty() || record.back().frame < last) && proc->Step())
+                ;
+        }
+        catch (const cv::Exception &e)
+        {
+            error = e.err;
+        }
+        catch (const std::exception &e)
+        {
+            error = e.what();
+        }
+
+        // the processor is kept for stitching, its capture threads are not
+        proc->Stop();
+
+        secs = (getTickCount() - start) / getTickFrequency();
+    }
+
+    CamShiftProcessor       *proc;
+    int                     last;
+    double                  secs;
+    vector<TrackRecord>     record;
+    string                  error;      // why tracking stopped early, if it did
+};
+
+
+/**
+ * Tracks one file in Segments parallel parts. The first segment starts
+ * from the selection. Each later one seeks Overlap frames ahead of its
+ * start, finds the target of the selection's histogram in the whole frame
+ * and tracks through the overlap, where its trajectory is stitched to the
+ * one before.
+ */
+static int track_segments(const string &File, const Rect &Selection, int Segments, int Overlap,
+                          const Settings &S, int Workers, const string &Track)
+{
+    vector<VideoCapture *>      caps;
+    vector<CamShiftProcessor *> procs;
+    vector<SegmentJob *>        jobs;
+    JobScheduler                scheduler(std::max(Workers, 0));
+    int64                       start = getTickCount();
+
+    VideoCapture *first = new VideoCapture(File.c_str());
+    caps.push_back(first);
+
+    int frames = first->isOpened() ? (int)first->get(CV_CAP_PROP_FRAME_COUNT) : 0;
+    if (frames <= 0)
+    {
+        cout << "***Could not open " << File << " or find its length***" << endl;
+        delete first;
+        return -1;
+    }
+
+    Segments = std::max(1, std::min(Segments, frames / std::max(Overlap, 1)));
+    int length = (frames + Segments - 1) / Segments;
+
+    // the first segment picks up the histogram of the selection
+    CamShiftProcessor *camshift = make_processor(*first, File, S);
+    camshift->SetHeadless(true);
+    camshift->SetSelection(Selection);
+    procs.push_back(camshift);
+    jobs.push_back(new SegmentJob(camshift, length));
+    if (!camshift->Step())
+    {
+        cout << "***Could not start tracking " << File << "***" << endl;
+        Segments = 0;
+    }
+
+    for (int k = 1; k < Segments; ++k)
+    {
+        VideoCapture *cap = new VideoCapture(File.c_str());
+        caps.push_back(cap);
+
+        // frames land where the container can seek, use what we got
+        cap->set(CV_CAP_PROP_POS_FRAMES, std::max(k * length - Overlap, 0));
+        int pos = (int)cap->get(CV_CAP_PROP_POS_FRAMES);
+
+        camshift = make_processor(*cap, File, S);
+        camshift->SetHeadless(true);
+        camshift->SetFrameOffset(pos);
+        camshift->SetHistogram(procs[0]->Histogram(), Selection.size());
+        procs.push_back(camshift);
+        jobs.push_back(new SegmentJob(camshift, std::min((k + 1) * length, frames)));
+    }
+
+    for (size_t k = 0; k < jobs.size() && Segments > 0; ++k)
+        scheduler.submit(jobs[k]);
+    scheduler.run();
+
+    vector<TrackRecord>     trajectory;
+    bool                    failed = false;
+
+    for (size_t k = 0; k < jobs.size() && Segments > 0; ++k)
+    {
+        float gap = stitch_trajectory(trajectory, jobs[k]->record);
+
+        cout << "Segment " << k << ": " << jobs[k]->record.size() << " frames in "
+             << jobs[k]->secs << " s";
+        if (!jobs[k]->error.empty())
+        {
+            cout << ", failed: " << jobs[k]->error;
+            failed = true;
+        }
+        if (k > 0)
+        {
+            if (gap < 0)
+                cout << ", no common frame with the previous segment";
+            else
+                cout << ", stitched " << gap << " px apart";
+        }
+        cout << endl;
+    }
+
+    double secs = (getTickCount() - start) / getTickFrequency();
+    cout << trajectory.size() << " frames in " << Segments << " segments on "
+         << scheduler.workers() << " workers in " << secs << " s ("
+         << (secs > 0 ? trajectory.size() / secs : 0) << " fps)" << endl;
+
+    if (!Track.empty())
+    {
+        ofstream out(Track.c_str());
+
+        write_trajectory_header(out);
+        for (size_t i = 0; i < trajectory.size(); ++i)
+            write_trajectory(out, trajectory[i]);
+    }
+
+    for (size_t k = 0; k < jobs.size(); ++k)
+        delete jobs[k];
+    for (size_t k = 0; k < procs.size(); ++k)
+        delete procs[k];
+    for (size_t k = 0; k < caps.size(); ++k)
+        delete caps[k];
+
+    return Segments > 0 && !failed ? 0 : -1;
+}
+
+
 int main(int argc, char** argv)
 {
     VideoCapture                cap;
     cmdln::parser_t             cmd_ln("Curve Fitting Object Tracker");
     cmdln::opt_val_t<int>       rotate("r", "rotate", "Rotate video images.", 0);
+    cmdln::opt_val_t<bool>      rotate_coords("", "rotate-coords", "Track unrotated, rotate only display and coordinates", false);
     cmdln::opt_val_t<string>    file("f", "file", "Use file for video source", "");
     cmdln::opt_val_t<int>       scale("s", "scale", "Scale input images", 1);
     cmdln::opt_val_t<int>       camNum("c", "camera", "input camera device", -1);
@@ -44,10 +545,36 @@ int main(int argc, char** argv)
     cmdln::opt_val_t<int>       y("y", "ycoord", "Selection y-coordinate", 0);
     cmdln::opt_val_t<int>       h("g", "height", "Selection input height", 0);
     cmdln::opt_val_t<int>       w("w", "width", "Selection input width", 0);
+    cmdln::opt_val_t<int>       queue("", "queue", "Decode on a capture thread into N frame buffers (0 = off)", 0);
+    cmdln::opt_val_t<bool>      drop("", "drop", "Drop the oldest frame when the capture queue is full", false);
+    cmdln::opt_val_t<int>       pipeline("", "pipeline", "Decode, transform and convert on a pipeline with N frame queues (0 = off)", 0);
+    cmdln::opt_val_t<bool>      headless("", "headless", "Process without display as fast as possible", false);
+    cmdln::opt_val_t<string>    output("o", "output", "Write processed frames with overlays to video file", "");
+    cmdln::opt_val_t<string>    track("t", "track", "Write the tracked box of every frame to CSV file", "");
+    cmdln::opt_val_t<bool>      roi("", "roi", "Process only a region around the predicted window", false);
+    cmdln::opt_val_t<double>    latency("", "latency", "End-to-end latency budget in ms for live sources, drops frames and effort when behind, needs --queue or --pipeline (0 = off)", 0);
+    cmdln::opt_val_t<int>       skip("", "skip", "Track every k-th frame, k up to N while predictions hold, and predict the rest (0 = off)", 0);
+    cmdln::opt_val_t<float>     skip_error("", "skip-error", "Prediction error in pixels --skip tolerates", 2);
+    cmdln::opt_val_t<bool>      pyramid("", "pyramid", "Converge CamShift on a downscaled backprojection first for large targets", false);
+    cmdln::opt_val_t<bool>      tiled("", "tiled", "Backproject in row bands on all cores", false);
+    cmdln::opt_list_t<string>   targets("", "target", "Track the target at x,y,w,h, repeat for more targets");
+    cmdln::opt_list_t<string>   streams("", "stream", "Track source@x,y,w,h headless, repeat for more streams");
+    cmdln::opt_val_t<string>    manifest("", "manifest", "Track every clip listed in the manifest file, see Manifest.hpp", "");
+    cmdln::opt_val_t<string>    summary("", "summary", "Per clip results of --manifest", "summary.csv");
+    cmdln::opt_val_t<int>       segments("", "segments", "Track the file in N parallel segments (1 = off)", 1);
+    cmdln::opt_val_t<int>       overlap("", "overlap", "Frames --segments overlap for stitching", 50);
+    cmdln::opt_val_t<int>       workers("", "workers", "Worker threads for --stream, --manifest and --segments (0 = one per core)", 0);
+    cmdln::opt_val_t<bool>      pin("", "pin", "Pin --stream workers to cores", false);
+    cmdln::opt_val_t<int>       lut("", "lut", "Backproject through a BGR table of 2^(3*N) cells (0 = off)", 0);
+
+    const char                  *model_names[] = { "curve", "spline", "kalman", "kalman-cv", "ensemble" };
+    set<string>                 models(model_names, model_names + 5);
+    cmdln::opt_set_t<string>    model("m", "model", "Motion predictor", models, "curve");
 
 
 
     cmd_ln.add(rotate);
+    cmd_ln.add(rotate_coords);
     cmd_ln.add(file);
     cmd_ln.add(scale);
     cmd_ln.add(camNum);
@@ -59,12 +586,71 @@ int main(int argc, char** argv)
     cmd_ln.add(y);
     cmd_ln.add(h);
     cmd_ln.add(w);
+    cmd_ln.add(lut);
+    cmd_ln.add(roi);
+    cmd_ln.add(tiled);
+    cmd_ln.add(pyramid);
+    cmd_ln.add(skip);
+    cmd_ln.add(latency);
+    cmd_ln.add(skip_error);
+    cmd_ln.add(queue);
+    cmd_ln.add(drop);
+    cmd_ln.add(pipeline);
+    cmd_ln.add(headless);
+    cmd_ln.add(output);
+    cmd_ln.add(track);
+    cmd_ln.add(model);
+    cmd_ln.add(targets);
+    cmd_ln.add(streams);
+    cmd_ln.add(manifest);
+    cmd_ln.add(summary);
+    cmd_ln.add(segments);
+    cmd_ln.add(overlap);
+    cmd_ln.add(workers);
+    cmd_ln.add(pin);
 
 
     try
     {
         cmd_ln.parse(argc, argv);
 
+        Settings    settings;
+
+        settings.model = model.value();
+        settings.rotate = rotate;
+        settings.rotate_coords = rotate_coords;
+        settings.scale = scale;
+        settings.vmin = vmin;
+        settings.vmax = vmax;
+        settings.smin = smin;
+        settings.lut = lut;
+        settings.roi = roi;
+        settings.tiled = tiled;
+        settings.pyramid = pyramid;
+        settings.skip = skip;
+        settings.latency = latency;
+        settings.skip_error = skip_error;
+        settings.queue = queue;
+        settings.drop = drop;
+        settings.pipeline = pipeline;
+
+        // synchronous reads never seem to wait, see SetLatencyBudget()
+        if (settings.latency > 0 && settings.queue <= 0 && settings.pipeline <= 0)
+        {
+            cout << "--latency needs --queue or --pipeline" << endl;
+            return -1;
+        }
+
+        if (!manifest.value().empty())
+            return run_manifest(manifest.value(), settings, workers, summary.value());
+
+        if (segments > 1)
+            return track_segments(file.value(), Rect(x, y, w, h), segments, std::max(overlap.value(), 0),
+                                  settings, workers, track.value());
+
+        if (streams.size() > 0)
+            return track_streams(streams, settings, workers, pin, track.value());
+
         if ( camNum >= 0 ) {
             cout << "Using camera " << camNum.value() << endl;
             cap.open( camNum.value() );
@@ -82,10 +668,40 @@ int main(int argc, char** argv)
             return -1;
         }
 
-        CamShiftProcessor     *camshift = new CurveFitProcessor(cap, "Curve Fit");
+        if (targets.size() > 0)
+        {
+            MultiTargetProcessor *multi = make_multi_processor(cap, "Curve Fit", settings);
+
+            for (int i = 0; i < targets.size(); ++i)
+            {
+                Rect r;
+                if (!parse_rect(targets[i].c_str(), r))
+                {
+                    cout << "Target \"" << targets[i] << "\" is not x,y,w,h" << endl;
+                    delete multi;
+                    return -1;
+                }
+                multi->AddTarget(r);
+            }
+
+            multi->SetHeadless(headless);
+            if (!output.value().empty())
+                multi->SetOutput(output.value());
+            if (!track.value().empty())
+                multi->SetTrajectoryOutput(track.value());
+
+            multi->Play(paused);
+            delete multi;
+            return 0;
+        }
+
+        CamShiftProcessor     *camshift = make_processor(cap, "Curve Fit", settings);
 
-        camshift->SetTransform(rotate, scale);
-        camshift->SetThresholds(vmin, vmax, smin);
+        camshift->SetHeadless(headless);
+        if (!output.value().empty())
+            camshift->SetOutput(output.value());
+        if (!track.value().empty())
+            camshift->SetTrajectoryOutput(track.value());
 
         // If an initial region selection was provided on command line, set
         // the selection in the video processor.
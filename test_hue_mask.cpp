@@ -0,0 +1,136 @@
+#include <cstdlib>
+#include <iostream>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "HueMask.hpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Runs every HueMask row kernel the CPU supports on all 2^24 BGR values
+ * and on random images, and checks hue and mask against cvtColor, inRange
+ * and mixChannels. The full colour cube covers the hue rounding at 0 and
+ * 180 and the grays.
+ */
+
+static int failures = 0;
+
+// HueMask::hue_mask with a given row kernel.
+static void hue_mask_with(HueMask::RowKernel Kernel, const Mat &Bgr, Mat &Hue, Mat &Mask,
+                          int SMin, int VMin, int VMax)
+{
+    HueMask::Limits lim(SMin, VMin, VMax);
+
+    Hue.create(Bgr.size(), CV_8UC1);
+    Mask.create(Bgr.size(), CV_8UC1);
+
+    for (int y = 0; y < Bgr.rows; ++y)
+        Kernel(Bgr.ptr<uchar>(y), Hue.ptr<uchar>(y), Mask.ptr<uchar>(y), Bgr.cols, lim);
+}
+
+// The conversion camshiftdemo does.
+static void reference(const Mat &Bgr, Mat &Hue, Mat &Mask, int SMin, int VMin, int VMax)
+{
+    Mat hsv;
+    int ch[] = { 0, 0 };
+
+    cvtColor(Bgr, hsv, CV_BGR2HSV);
+    inRange(hsv, Scalar(0, SMin, MIN(VMin, VMax)), Scalar(180, 256, MAX(VMin, VMax)), Mask);
+    Hue.create(hsv.size(), hsv.depth());
+    mixChannels(&hsv, 1, &Hue, 1, ch, 1);
+}
+
+static void check(const char *Kernel, const char *Image, HueMask::RowKernel Run, const Mat &Bgr,
+                  int SMin, int VMin, int VMax)
+{
+    Mat hue, mask, ref_hue, ref_mask;
+
+    hue_mask_with(Run, Bgr, hue, mask, SMin, VMin, VMax);
+    reference(Bgr, ref_hue, ref_mask, SMin, VMin, VMax);
+
+    int hue_diff = countNonZero(hue != ref_hue);
+    int mask_diff = countNonZero(mask != ref_mask);
+
+    if (hue_diff || mask_diff)
+    {
+        cout << Kernel << " on " << Image << " " << Bgr.cols << "x" << Bgr.rows
+             << " smin=" << SMin << " vmin=" << VMin << " vmax=" << VMax << ": "
+             << hue_diff << " hues and " << mask_diff << " mask pixels differ" << endl;
+        ++failures;
+    }
+}
+
+// Every BGR value once, blue in the high bits.
+static Mat colour_cube()
+{
+    Mat cube(4096, 4096, CV_8UC3);
+
+    for (int y = 0; y < cube.rows; ++y)
+    {
+        uchar *p = cube.ptr<uchar>(y);
+        for (int x = 0; x < cube.cols; ++x, p += 3)
+        {
+            int i = y * cube.cols + x;
+            p[0] = (uchar)(i >> 16);
+            p[1] = (uchar)(i >> 8);
+            p[2] = (uchar)i;
+        }
+    }
+    return cube;
+}
+
+static void test_kernel(const char *Name, HueMask::RowKernel Run, const Mat &Cube)
+{
+    const int thresholds[][3] = {
+        { 30, 10, 256 }, { 0, 0, 255 }, { 255, 255, 255 }, { 60, 200, 40 }, { -5, -5, 300 }
+    };
+
+    for (int t = 0; t < 5; ++t)
+        check(Name, "colour cube", Run, Cube, thresholds[t][0], thresholds[t][1], thresholds[t][2]);
+
+    // widths around the vector lengths, and regions of a larger image whose
+    // rows are not contiguous
+    for (int i = 0; i < 200; ++i)
+    {
+        Mat image(1 + rand() % 64, 1 + rand() % 200, CV_8UC3);
+        randu(image, Scalar::all(0), Scalar::all(256));
+
+        int smin = rand() % 256, vmin = rand() % 256, vmax = rand() % 257;
+        check(Name, "random", Run, image, smin, vmin, vmax);
+
+        int x = rand() % image.cols, y = rand() % image.rows;
+        Mat part(image, Rect(x, y, image.cols - x, image.rows - y));
+        check(Name, "random region", Run, part, smin, vmin, vmax);
+    }
+}
+
+int main()
+{
+    theRNG() = RNG(1);
+    srand(1);
+
+    Mat cube = colour_cube();
+
+    test_kernel("scalar", HueMask::row_scalar, cube);
+#if HUE_MASK_X86
+    if (__builtin_cpu_supports("sse4.1"))
+        test_kernel("sse4.1", HueMask::row_sse41, cube);
+    else
+        cout << "No SSE4.1, its kernel is not tested" << endl;
+
+    if (__builtin_cpu_supports("avx2"))
+        test_kernel("avx2", HueMask::row_avx2, cube);
+    else
+        cout << "No AVX2, its kernel is not tested" << endl;
+#endif
+
+    if (failures)
+    {
+        cout << failures << " HueMask checks failed" << endl;
+        return 1;
+    }
+    cout << "HueMask agrees with cvtColor, inRange and mixChannels" << endl;
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include "LSFit.hpp"
+
+using namespace std;
+
+/**
+ * Pushes random samples through LSFit in incremental (normal equation) and
+ * batch (QR) mode side by side and checks both modes fit the same curve.
+ */
+
+static const double TOLERANCE = 1e-6;
+
+static int failures = 0;
+
+static double uniform(double Lo, double Hi)
+{
+    return Lo + (Hi - Lo) * rand() / RAND_MAX;
+}
+
+// Compares both fits over the window and one step past it.
+template<class Fit>
+static void compare(const char *Name, int Step, const Fit &Normal, const Fit &Batch,
+                    int Axis, int First, int Last)
+{
+    for (int x = First; x <= Last + 1; ++x)
+    {
+        double n = Normal.interpolate(Axis, x);
+        double b = Batch.interpolate(Axis, x);
+        if (std::abs(n - b) > TOLERANCE * (1 + std::abs(b)))
+        {
+            cout << Name << ": sample " << Step << " axis " << Axis << " at x=" << x
+                 << " incremental " << n << " batch " << b << endl;
+            ++failures;
+            return;
+        }
+    }
+}
+
+// Random cubic with noise, sampled at increasing x with gaps that make the
+// span double and the groups rebase.
+static void run(const char *Name, bool Weighted, size_t Capacity, int Samples)
+{
+    LS::LSFitN<3, 1, int, double> normal(Weighted, true, Capacity);
+    LS::LSFitN<3, 1, int, double> batch(Weighted, false, Capacity);
+    double c[3] = { uniform(-100, 100), uniform(-5, 5), uniform(-0.05, 0.05) };
+    int x = rand() % 1000;
+    int first = x;
+
+    for (int i = 0; i < Samples; ++i)
+    {
+        double t = x - first;
+        Vec<double, 1> y(c[0] + c[1] * t + c[2] * t * t + uniform(-2, 2));
+        normal.push_back(x, y);
+        batch.push_back(x, y);
+
+        if (normal.size(0) != batch.size(0))
+        {
+            cout << Name << ": sample " << i << " window " << normal.size(0)
+                 << " vs " << batch.size(0) << endl;
+            ++failures;
+            return;
+        }
+        compare(Name, i, normal, batch, 0, x - 2 * (int)normal.size(0), x);
+        x += 1 + (rand() % 8 == 0 ? rand() % 20 : 0);
+    }
+}
+
+// Two axes where one is cleared now and then and refits on its own group
+// until eviction merges the groups again.
+static void run_clear(const char *Name, bool Weighted, size_t Capacity, int Samples)
+{
+    LS::LSFitN<3, 2, int, double> normal(Weighted, true, Capacity);
+    LS::LSFitN<3, 2, int, double> batch(Weighted, false, Capacity);
+    size_t since_clear = 0;
+
+    for (int x = 0; x < Samples; ++x)
+    {
+        if (x % 17 == 9)
+        {
+            normal.clear(1);
+            batch.clear(1);
+            since_clear = 0;
+        }
+
+        Vec<double, 2> y(0.5 * x + uniform(-1, 1), 20 - 0.01 * x * x + uniform(-1, 1));
+        normal.push_back(x, y);
+        batch.push_back(x, y);
+        ++since_clear;
+
+        size_t expect = Capacity ? std::min(since_clear, Capacity) : since_clear;
+        if (normal.size(1) != expect || batch.size(1) != expect)
+        {
+            cout << Name << ": sample " << x << " cleared axis fits " << normal.size(1)
+                 << " and " << batch.size(1) << " samples, expected " << expect << endl;
+            ++failures;
+            return;
+        }
+        for (int axis = 0; axis < 2; ++axis)
+            compare(Name, x, normal, batch, axis, x - (int)normal.size(axis), x);
+    }
+}
+
+int main()
+{
+    srand(1);
+
+    run("unweighted", false, 0, 300);
+    run("weighted", true, 0, 300);
+    run("unweighted window", false, 16, 500);
+    run("weighted window", true, 16, 500);
+    run("short window", true, 2, 50);
+    run_clear("clear axis", false, 0, 200);
+    run_clear("clear axis window", true, 12, 300);
+
+    if (failures)
+    {
+        cout << failures << " LSFit checks failed" << endl;
+        return 1;
+    }
+    cout << "LSFit incremental and batch fits agree" << endl;
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include <cstdlib>
+#include <iostream>
+
+#include "opencv2/video/tracking.hpp"
+
+#include "MomentShift.hpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Runs MomentShift's mean_shift and cam_shift and OpenCV's meanShift and
+ * CamShift on the same random backprojections and checks the windows,
+ * step counts and boxes agree bit for bit.
+ */
+
+static int failures = 0;
+
+// Noise plus a few blobs of constant weight, some touching the border.
+static Mat random_weights(int Rows, int Cols)
+{
+    Mat w(Rows, Cols, CV_8UC1);
+
+    randu(w, Scalar(0), Scalar(256));
+    w &= Scalar(rand() % 2 ? 0x0f : 0x00);
+
+    for (int n = rand() % 4; n >= 0; --n)
+    {
+        Point   c(rand() % Cols, rand() % Rows);
+        Size    axes(4 + rand() % (Cols / 3), 4 + rand() % (Rows / 3));
+        ellipse(w, c, axes, rand() % 180, 0, 360, Scalar(64 + rand() % 192), -1);
+    }
+    return w;
+}
+
+// Window of random size, now and then reaching out of the image.
+static Rect random_window(const Mat &Weights)
+{
+    int w = 1 + rand() % (Weights.cols / 2);
+    int h = 1 + rand() % (Weights.rows / 2);
+    return Rect(rand() % (Weights.cols + w) - w / 2, rand() % (Weights.rows + h) - h / 2, w, h);
+}
+
+static TermCriteria random_criteria()
+{
+    switch (rand() % 4)
+    {
+    case 0:     return TermCriteria(CV_TERMCRIT_ITER, 1 + rand() % 10, 0);
+    case 1:     return TermCriteria(CV_TERMCRIT_EPS, 0, 0.5 + rand() % 4);
+    default:    return TermCriteria(CV_TERMCRIT_EPS | CV_TERMCRIT_ITER, 1 + rand() % 10, 1);
+    }
+}
+
+static bool same(const RotatedRect &A, const RotatedRect &B)
+{
+    return A.center == B.center && A.size == B.size && A.angle == B.angle;
+}
+
+static void report(const char *What, int Case, const Mat &Weights, const Rect &Window,
+                   const Rect &Got, const Rect &Expected)
+{
+    cout << What << " case " << Case << " on " << Weights.cols << "x" << Weights.rows
+         << " from " << Window.x << "," << Window.y << " " << Window.width << "x" << Window.height
+         << ": " << Got.x << "," << Got.y << " " << Got.width << "x" << Got.height
+         << " instead of " << Expected.x << "," << Expected.y << " "
+         << Expected.width << "x" << Expected.height << endl;
+    ++failures;
+}
+
+int main()
+{
+    theRNG() = RNG(1);
+    srand(1);
+
+    for (int i = 0; i < 2000; ++i)
+    {
+        Mat             weights = random_weights(16 + rand() % 300, 16 + rand() % 400);
+        Rect            start = random_window(weights);
+        TermCriteria    term = random_criteria();
+
+        // an empty image makes both give up
+        if (i % 100 == 0)
+            weights = Scalar::all(0);
+
+        Rect    ours = start, theirs = start;
+        int     steps = MomentShift::mean_shift(weights, ours, term);
+        int     expected = meanShift(weights, theirs, term);
+
+        if (ours != theirs || steps != expected)
+            report("mean_shift", i, weights, start, ours, theirs);
+
+        ours = theirs = start;
+        RotatedRect box = MomentShift::cam_shift(weights, ours, term);
+        RotatedRect expected_box = CamShift(weights, theirs, term);
+
+        if (ours != theirs || !same(box, expected_box))
+            report("cam_shift", i, weights, start, ours, theirs);
+    }
+
+    if (failures)
+    {
+        cout << failures << " MomentShift checks failed" << endl;
+        return 1;
+    }
+    cout << "MomentShift agrees with meanShift and CamShift" << endl;
+    return 0;
+}